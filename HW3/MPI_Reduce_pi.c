@@ -1,49 +1,135 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <sys/time.h>
 #include <math.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <omp.h>
 #include <mpi.h>
+#include "rng.h"
+#include "pi_kernel.h"
+#include "work_share.h"
 
 #define ull unsigned long long int 
+// samples between two MPI_Test calls while a reduction is in flight
+#define PROGRESS_BLOCK 16384
+// two sided 95% normal quantile for the -e stopping rule
+#define Z_95 1.959963984540054
 
 
-double rand01();
-double dist_to_origin(double x, double y);
 double elapsed_seconds();
+void print_memory_usage(int my_rank);
+void adaptive_sampling(ull max_size, ull round_size, double target, int thread_count, ull seed, int my_rank, int p_size);
 
 int main(int argc, char** argv)
 {
     //setting up MPI and broadcasting parameter
     ull sample_size;
+    int thread_count = 1;
+    ull min_chunk = 0; // 0 means every core takes the same number of samples
+    double target = 0; // 0 means a fixed sample_size run
+    ull round_size = 262144;
+    ull seed;
     int p_size, my_rank;
+    int provided;
     double begin;
-    MPI_Init(NULL, NULL);
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size(MPI_COMM_WORLD, &p_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    // the OpenMP threads of -t run while only the main thread calls MPI
+    if(provided < MPI_THREAD_FUNNELED)
+    {
+        if(0 == my_rank)
+        {
+            printf("The MPI library does not support MPI_THREAD_FUNNELED\n");
+            fflush(stdout);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
     if(0 == my_rank)
     {
-        if(2 != argc)
+        struct option long_options[] =
+        {
+            {"threads", required_argument, NULL, 't'},
+            {"seed", required_argument, NULL, 'S'},
+            {"dynamic", required_argument, NULL, 'd'},
+            {"target", required_argument, NULL, 'e'},
+            {"round", required_argument, NULL, 'r'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        seed = rng_time_seed();
+        while(-1 != (optchar = getopt_long(argc, argv, "t:S:e:r:d:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 't':
+                    thread_count = strtol(optarg, NULL, 10);
+                    break;
+                case 'S':
+                    seed = strtoull(optarg, NULL, 10);
+                    break;
+                case 'd':
+                    min_chunk = strtoull(optarg, NULL, 10);
+                    break;
+                case 'e':
+                    target = strtod(optarg, NULL);
+                    break;
+                case 'r':
+                    round_size = strtoull(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(1 != argc-optind || thread_count < 1 || target < 0 || 0 == round_size)
         {
             printf("Wrong number of arguments\n");
             exit(1);
         }
-        sample_size = strtoull(argv[1], NULL, 10);
+        if(0 < target && 0 < min_chunk)
+        {
+            printf("-e can not be combined with -d\n");
+            exit(1);
+        }
+        sample_size = strtoull(argv[optind], NULL, 10);
     }
     MPI_Bcast(&sample_size, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&thread_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&min_chunk, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&target, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&round_size, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    if(0 < target)
+    {
+        adaptive_sampling(sample_size, round_size, target, thread_count, seed, my_rank, p_size);
+        print_memory_usage(my_rank);
+        MPI_Finalize();
+        return 0;
+    }
     
     MPI_Barrier(MPI_COMM_WORLD);
     begin = elapsed_seconds();
-    // sampling
-    unsigned int seed = time(NULL)*(my_rank+1);
+    // sampling, every thread of every core takes sample_size samples
+    // from its own stream and the threads are summed up by the reduction clause.
+    // The stream number is the global thread number, so for a given seed the
+    // estimate only depends on cores*threads, not on how they are split.
+    // With -d the samples of all cores are handed out in chunks instead.
     ull in_circle_count = 0;
-    for(ull i=0; i<sample_size; i++)
+    if(0 < min_chunk)
+    {
+        in_circle_count = dynamic_count_in_circle((ull)p_size*thread_count*sample_size, min_chunk, thread_count, seed, my_rank, p_size);
+    }
+    else
     {
-        double x = rand01(&seed);
-        double y = rand01(&seed);
-        if(dist_to_origin(x, y) <= (double)1)
+        #pragma omp parallel num_threads(thread_count) reduction(+:in_circle_count)
         {
-            in_circle_count++;
+            rng_t rng;
+            rng_init(&rng, seed, (ull)my_rank*thread_count+omp_get_thread_num());
+            in_circle_count += pi_count_in_circle(&rng, sample_size);
         }
     }
     // sending result to core 0 and printing the final result
@@ -51,24 +137,116 @@ int main(int argc, char** argv)
     MPI_Reduce(&in_circle_count, &total_in_circle_count, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
     if(0 == my_rank)
     {
-        double pi_estimate = (double) 4 * (double) total_in_circle_count / (double) p_size / (double) sample_size;
+        double pi_estimate = (double) 4 * (double) total_in_circle_count / (double) p_size / (double) thread_count / (double) sample_size;
         double accuracy = fabs((M_PI-pi_estimate)/M_PI);
         double end = elapsed_seconds();
         printf("Estimate of pi: %f\n", pi_estimate);
         printf("Accuracy of estimation: %e\n", accuracy);
+        printf("Seed: %llu\n", seed);
+        printf("Cores x threads: %d x %d\n", p_size, thread_count);
+        printf("Sampling kernel: %s\n", pi_kernel_name());
         printf("Time taken: %f\n", end-begin);
+        printf("Samples per second per thread: %e\n", (double) sample_size / (end-begin));
     }
+    print_memory_usage(my_rank);
     MPI_Finalize();
     return 0;
 }
 
-double rand01(unsigned int* seed)
+// Samples in rounds of round_size per thread until the 95% confidence
+// interval of the estimate is within target relative error, or until every
+// thread took max_size samples. After each round the cores start an
+// MPI_Iallreduce of their (in circle, samples) counts and go on sampling the
+// next round while it is in flight; the master thread pokes it with MPI_Test.
+// The totals are checked one round later, and since every core waits for the
+// same reduction after the same round, all cores stop together.
+void adaptive_sampling(ull max_size, ull round_size, double target, int thread_count, ull seed, int my_rank, int p_size)
 {
-    return ((double) rand_r(seed)) / ((double) RAND_MAX);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double begin = elapsed_seconds();
+    rng_t* rngs = (rng_t*) malloc(thread_count*sizeof(rng_t));
+    for(int t=0; t<thread_count; t++)
+    {
+        rng_init(&rngs[t], seed, (ull)my_rank*thread_count+t);
+    }
+    ull counts[2] = {0, 0};       // in circle, samples of this core
+    ull sent[2], totals[2] = {0, 0};
+    MPI_Request request = MPI_REQUEST_NULL;
+    ull per_thread = 0;
+    int rounds = 0;
+    int reached = 0;
+    double relative_error = 1;
+    while(!reached && per_thread < max_size)
+    {
+        ull len = max_size-per_thread<round_size ? max_size-per_thread : round_size;
+        ull in_circle_count = 0;
+        #pragma omp parallel num_threads(thread_count) reduction(+:in_circle_count)
+        {
+            int t = omp_get_thread_num();
+            for(ull done=0; done<len; done+=PROGRESS_BLOCK)
+            {
+                ull n = len-done<PROGRESS_BLOCK ? len-done : PROGRESS_BLOCK;
+                in_circle_count += pi_count_in_circle(&rngs[t], n);
+                if(0 == t && MPI_REQUEST_NULL != request)
+                {
+                    int flag;
+                    MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+                }
+            }
+        }
+        counts[0] += in_circle_count;
+        counts[1] += len*thread_count;
+        per_thread += len;
+        rounds++;
+
+        if(1 < rounds)
+        {
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+            double q = (double) totals[0] / (double) totals[1];
+            relative_error = Z_95*sqrt((1-q)/(q*(double) totals[1]));
+            reached = relative_error <= target;
+        }
+        if(!reached)
+        {
+            sent[0] = counts[0];
+            sent[1] = counts[1];
+            MPI_Iallreduce(sent, totals, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD, &request);
+        }
+    }
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    // the final estimate uses every sample, including the last round
+    MPI_Reduce(counts, totals, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(0 == my_rank)
+    {
+        double q = (double) totals[0] / (double) totals[1];
+        double pi_estimate = 4*q;
+        double end = elapsed_seconds();
+        relative_error = Z_95*sqrt((1-q)/(q*(double) totals[1]));
+        printf("Estimate of pi: %f\n", pi_estimate);
+        printf("Accuracy of estimation: %e\n", fabs((M_PI-pi_estimate)/M_PI));
+        printf("95%% confidence relative error: %e (target %e%s)\n", relative_error, target, reached ? "" : ", not reached");
+        printf("Samples: %llu in %d rounds\n", totals[1], rounds);
+        printf("Seed: %llu\n", seed);
+        printf("Cores x threads: %d x %d\n", p_size, thread_count);
+        printf("Time taken: %f\n", end-begin);
+    }
+    free(rngs);
 }
-double dist_to_origin(double x, double y)
+
+// peak resident memory of every core, summed and maxed on core 0, to compare
+// a cores x threads launch with the same number of single threaded cores
+void print_memory_usage(int my_rank)
 {
-    return sqrt(x*x + y*y);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long max_rss = usage.ru_maxrss; // in kilobytes on Linux
+    long total_rss, largest_rss;
+    MPI_Reduce(&max_rss, &total_rss, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&max_rss, &largest_rss, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(0 == my_rank)
+    {
+        printf("Peak memory (KB): %ld total, %ld largest core\n", total_rss, largest_rss);
+    }
 }
 
 double elapsed_seconds()
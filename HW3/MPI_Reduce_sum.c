@@ -1,73 +1,216 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <string.h>
+#include <math.h>
+#include <getopt.h>
 #include <mpi.h>
+#include "repro_sum.h"
+#include "latency.h"
+#include "max_message.h"
+
+// -f multiplies every element by this, as in tree_sum
+#define FRACTION_SCALE 0.1
 
 double elapsed_seconds();
-void test_result(double* vector_sum, int vector_count, int vector_size);
+double cpu_seconds();
+void test_result(double* vector_sum, long long vector_count, long long vector_size, int print_values);
+void print_error(double* vector_sum, long long vector_count, long long vector_size, double scale);
+void reduce_pieces(double* vector_sum, double* res_sum, long long vector_size, int allreduce);
+void iterate_reduce(double* vector_sum, double* res_sum, long long vector_size, int allreduce, long long iterations, double* latencies);
 
 int main(int argc, char** argv)
 {
     // setting up MPI and broadcasting parameters
-    int vector_count, vector_size;
+    long long vector_count, vector_size;
+    int allreduce = 0;
+    int reproducible = 0;
+    int fraction = 0;
+    long long iterations = 0; // 0 means one reduction
     int p_size, my_rank;
-    int start_i, end_i;
+    long long start_i, end_i;
     double begin;
     MPI_Init(NULL, NULL);
     MPI_Comm_size(MPI_COMM_WORLD, &p_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
     if(0 == my_rank)
     {
-        if(3 != argc)
+        struct option long_options[] =
+        {
+            {"allreduce", no_argument, NULL, 'a'},
+            {"reproducible", no_argument, NULL, 'r'},
+            {"fraction", no_argument, NULL, 'f'},
+            {"iterations", required_argument, NULL, 'i'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        while(-1 != (optchar = getopt_long(argc, argv, "arfi:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 'a':
+                    allreduce = 1;
+                    break;
+                case 'r':
+                    reproducible = 1;
+                    break;
+                case 'f':
+                    fraction = 1;
+                    break;
+                case 'i':
+                    iterations = strtoll(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(2 != argc-optind || iterations < 0)
         {
             printf("Wrong number of arguments\n");
             exit(1);
         }
-        vector_count = strtol(argv[1], NULL, 10);
-        vector_size = strtol(argv[2], NULL, 10);
+        if(reproducible && 0 < iterations)
+        {
+            printf("-r can not be combined with -i\n");
+            exit(1);
+        }
+        vector_count = strtoll(argv[optind], NULL, 10);
+        vector_size = strtoll(argv[optind+1], NULL, 10);
     }
-    MPI_Bcast(&vector_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&vector_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&vector_count, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&vector_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&allreduce, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&reproducible, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&fraction, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&iterations, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    double* latencies = NULL;
+    double scale = fraction ? FRACTION_SCALE : 1;
     // distributing vectors to add
     if(my_rank < vector_count%p_size)
     {
-        int temp = vector_count/p_size;
+        long long temp = vector_count/p_size;
         start_i = my_rank * temp + my_rank;
         end_i = start_i + temp + 1;
     }
     else
     {
-        int temp = vector_count/p_size;
+        long long temp = vector_count/p_size;
         start_i = my_rank * temp + vector_count%p_size;
         end_i = start_i + temp;
     }
+    // -r: accumulators of repro_sum.h reduced with their own MPI_Op, set up
+    // from the largest element any core adds
+    MPI_Datatype repro_type;
+    MPI_Op repro_op;
+    if(reproducible)
+    {
+        double max_abs = start_i<end_i ? ((double)(end_i-1)*(double)vector_size + (double)(vector_size-1))*scale : 0;
+        MPI_Allreduce(MPI_IN_PLACE, &max_abs, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        repro_setup(max_abs, vector_count);
+        repro_mpi_create(&repro_type, &repro_op);
+    }
 
     MPI_Barrier(MPI_COMM_WORLD);
     begin = elapsed_seconds();
     // adding vectors
-    double* vector_sum;
-    vector_sum = (double*) malloc(vector_size*sizeof(double));
-    memset(vector_sum, 0 ,vector_size*sizeof(double));
-    for(int i=start_i; i<end_i; i++)
+    double* vector_sum = NULL; // -r adds into acc instead
+    double* acc = NULL;
+    if(reproducible)
     {
-        for(int j=0; j<vector_size; j++)
+        acc = (double*) malloc(vector_size*REPRO_FOLDS*sizeof(double));
+        repro_add_vectors(acc, start_i, end_i, vector_size, 1, scale);
+    }
+    else
+    {
+        vector_sum = (double*) malloc(vector_size*sizeof(double));
+        memset(vector_sum, 0 ,vector_size*sizeof(double));
+        for(long long i=start_i; i<end_i; i++)
         {
-            vector_sum[j] += (double)i*(double)vector_size + (double)j;
+            for(long long j=0; j<vector_size; j++)
+            {
+                vector_sum[j] += ((double)i*(double)vector_size + (double)j)*scale;
+            }
         }
     }
-    // sending results to core 0
+    // sending results to core 0, or to every core with -a
+    double reduce_begin = elapsed_seconds();
+    double cpu_begin = cpu_seconds();
     double* res_sum;
     res_sum = (double*) malloc(vector_size*sizeof(double));
-    MPI_Reduce(vector_sum, res_sum, vector_size, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(reproducible)
+    {
+        // pieces of MAX_MESSAGE doubles, REPRO_FOLDS of them per element
+        double* res_acc = (double*) malloc(vector_size*REPRO_FOLDS*sizeof(double));
+        long long piece = MAX_MESSAGE/REPRO_FOLDS;
+        for(long long offset=0; offset<vector_size; offset+=piece)
+        {
+            int len = (int)(vector_size-offset<piece ? vector_size-offset : piece);
+            if(allreduce)
+            {
+                MPI_Allreduce(acc+offset*REPRO_FOLDS, res_acc+offset*REPRO_FOLDS, len, repro_type, repro_op, MPI_COMM_WORLD);
+            }
+            else
+            {
+                MPI_Reduce(acc+offset*REPRO_FOLDS, res_acc+offset*REPRO_FOLDS, len, repro_type, repro_op, 0, MPI_COMM_WORLD);
+            }
+        }
+        if(allreduce || 0 == my_rank)
+        {
+            repro_finish(res_acc, res_sum, vector_size);
+        }
+        free(res_acc);
+        free(acc);
+    }
+    else if(0 < iterations)
+    {
+        latencies = (double*) malloc(iterations*sizeof(double));
+        iterate_reduce(vector_sum, res_sum, vector_size, allreduce, iterations, latencies);
+    }
+    else
+    {
+        reduce_pieces(vector_sum, res_sum, vector_size, allreduce);
+    }
+    double end = elapsed_seconds();
+    double cpu_time = cpu_seconds()-cpu_begin;
+    if(0 < iterations)
+    {
+        // an iteration takes as long as its slowest core
+        MPI_Reduce(0==my_rank ? MPI_IN_PLACE : latencies, latencies, iterations, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
     // testing and printing out results
     if(0 == my_rank)
     {
-        double end = elapsed_seconds();
         printf("Time taken: %f\n", end-begin);
-        test_result(res_sum, vector_count, vector_size); // test result
+        printf("Reduction time: %f (core 0 CPU time: %f)\n", end-reduce_begin, cpu_time);
+        if(0 < iterations)
+        {
+            print_latencies(latencies, iterations, MPI_VERSION >= 4 ? "persistent collectives" : "blocking collectives, MPI 3");
+        }
+        if(reproducible || fraction)
+        {
+            printf("Result hash: %016llx\n", (unsigned long long)repro_hash(res_sum, vector_size));
+        }
+        if(fraction)
+        {
+            print_error(res_sum, vector_count, vector_size, scale); // no exact test
+        }
+        else
+        {
+            test_result(res_sum, vector_count, vector_size, 1); // test result
+        }
+    }
+    else if(allreduce && !fraction)
+    {
+        test_result(res_sum, vector_count, vector_size, 0); // every core holds the sum
     }
 
+    if(reproducible)
+    {
+        repro_mpi_free(&repro_type, &repro_op);
+    }
+    free(latencies);
     free(res_sum);
     free(vector_sum);
     MPI_Finalize();
@@ -82,24 +225,116 @@ double elapsed_seconds()
     return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
 }
 
-void test_result(double* vector_sum, int vector_count, int vector_size)
+// user plus system time of this core
+double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1000000.0;
+}
+
+void test_result(double* vector_sum, long long vector_count, long long vector_size, int print_values)
 {
     double res = (double)vector_size*(double)vector_count*(double)(vector_count-1)/(double)2;
-    for(int i=0; i<vector_size; i++)
+    for(long long i=0; i<vector_size; i++)
     {
         double expected = res+(double)i*(double)vector_count;
         if(vector_sum[i] != expected)
         {
-            printf("Wrong value at %d\n", i);
+            printf("Wrong value at %lld\n", i);
             printf("Expected: %.0f\n", expected);
             printf("Actual: %.0f\n", vector_sum[i]);
             exit(1);
         }
     }
+    if(!print_values)
+    {
+        return;
+    }
     int iterSize = vector_size<30 ? vector_size : 30;
     for(int i=0; i<iterSize; i++)
     {
         printf("%.0f, ", vector_sum[i]);
     }
     printf("\n");
-}
\ No newline at end of file
+}
+
+// how far the result is from the exact sum, for -f
+void print_error(double* vector_sum, long long vector_count, long long vector_size, double scale)
+{
+    double res = (double)vector_size*(double)vector_count*(double)(vector_count-1)/(double)2;
+    double max_relative = 0;
+    for(long long i=0; i<vector_size; i++)
+    {
+        double expected = (res+(double)i*(double)vector_count)*scale;
+        double error = fabs(vector_sum[i]-expected);
+        if(0 != expected && error/fabs(expected) > max_relative)
+        {
+            max_relative = error/fabs(expected);
+        }
+    }
+    printf("Max relative error: %e\n", max_relative);
+}
+
+// MPI_Reduce, or MPI_Allreduce with -a, of vector_sum into res_sum in pieces
+// of at most MAX_MESSAGE doubles
+void reduce_pieces(double* vector_sum, double* res_sum, long long vector_size, int allreduce)
+{
+    for(long long offset=0; offset<vector_size; offset+=MAX_MESSAGE)
+    {
+        int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+        if(allreduce)
+        {
+            MPI_Allreduce(vector_sum+offset, res_sum+offset, len, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        }
+        else
+        {
+            MPI_Reduce(vector_sum+offset, res_sum+offset, len, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        }
+    }
+}
+
+// --iterations: the reduction repeated iterations times on the same buffers.
+// With MPI 4 every piece is a persistent collective (MPI_Reduce_init or
+// MPI_Allreduce_init) set up once and started every iteration, older MPI
+// stacks call reduce_pieces every time. latencies[k] is how long iteration k
+// took on this core, from a barrier.
+void iterate_reduce(double* vector_sum, double* res_sum, long long vector_size, int allreduce, long long iterations, double* latencies)
+{
+#if MPI_VERSION >= 4
+    long long pieces = (vector_size+MAX_MESSAGE-1)/MAX_MESSAGE;
+    MPI_Request* requests = (MPI_Request*) malloc((pieces+1)*sizeof(MPI_Request));
+    for(long long k=0; k<pieces; k++)
+    {
+        long long offset = k*MAX_MESSAGE;
+        int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+        if(allreduce)
+        {
+            MPI_Allreduce_init(vector_sum+offset, res_sum+offset, len, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, MPI_INFO_NULL, requests+k);
+        }
+        else
+        {
+            MPI_Reduce_init(vector_sum+offset, res_sum+offset, len, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, MPI_INFO_NULL, requests+k);
+        }
+    }
+#endif
+    for(long long it=0; it<iterations; it++)
+    {
+        MPI_Barrier(MPI_COMM_WORLD);
+        double begin = MPI_Wtime(); // finer than gettimeofday for short iterations
+#if MPI_VERSION >= 4
+        MPI_Startall(pieces, requests);
+        MPI_Waitall(pieces, requests, MPI_STATUSES_IGNORE);
+#else
+        reduce_pieces(vector_sum, res_sum, vector_size, allreduce);
+#endif
+        latencies[it] = MPI_Wtime()-begin;
+    }
+#if MPI_VERSION >= 4
+    for(long long k=0; k<pieces; k++)
+    {
+        MPI_Request_free(requests+k);
+    }
+    free(requests);
+#endif
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <string.h>
+#include <getopt.h>
+#include <mpi.h>
+#include "max_message.h"
+
+double elapsed_seconds();
+double cpu_seconds();
+void test_result(double* vector_sum, long long vector_count, long long vector_size, int print_values);
+
+int main(int argc, char** argv)
+{
+    // setting up MPI and broadcasting parameters
+    long long vector_count, vector_size;
+    long long chunk_size = 0; // 0 means accumulate the whole vector at once
+    int p_size, my_rank;
+    long long start_i, end_i;
+    double begin;
+    MPI_Init(NULL, NULL);
+    MPI_Comm_size(MPI_COMM_WORLD, &p_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    if(0 == my_rank)
+    {
+        struct option long_options[] =
+        {
+            {"chunk", required_argument, NULL, 'c'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        while(-1 != (optchar = getopt_long(argc, argv, "c:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 'c':
+                    chunk_size = strtoll(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(2 != argc-optind || chunk_size < 0)
+        {
+            printf("Wrong number of arguments\n");
+            exit(1);
+        }
+        vector_count = strtoll(argv[optind], NULL, 10);
+        vector_size = strtoll(argv[optind+1], NULL, 10);
+    }
+    MPI_Bcast(&vector_count, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&vector_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&chunk_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if(0 == chunk_size || vector_size < chunk_size)
+    {
+        chunk_size = vector_size;
+    }
+    if(MAX_MESSAGE < chunk_size)
+    {
+        chunk_size = MAX_MESSAGE;
+    }
+    // distributing vectors to add
+    if(my_rank < vector_count%p_size)
+    {
+        long long temp = vector_count/p_size;
+        start_i = my_rank * temp + my_rank;
+        end_i = start_i + temp + 1;
+    }
+    else
+    {
+        long long temp = vector_count/p_size;
+        start_i = my_rank * temp + vector_count%p_size;
+        end_i = start_i + temp;
+    }
+    // the result vector lives in a window on core 0, created and zeroed once
+    // outside the timing
+    double* res_sum;
+    MPI_Win window;
+    MPI_Win_allocate(0==my_rank ? vector_size*sizeof(double) : 0, sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD, &res_sum, &window);
+    if(0 == my_rank)
+    {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+        memset(res_sum, 0, vector_size*sizeof(double));
+        MPI_Win_unlock(0, window);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    begin = elapsed_seconds();
+    // adding vectors
+    double* vector_sum;
+    vector_sum = (double*) malloc(vector_size*sizeof(double));
+    memset(vector_sum, 0 ,vector_size*sizeof(double));
+    for(long long i=start_i; i<end_i; i++)
+    {
+        for(long long j=0; j<vector_size; j++)
+        {
+            vector_sum[j] += (double)i*(double)vector_size + (double)j;
+        }
+    }
+    // sending results to core 0: every core adds its partial sum into the
+    // window with MPI_Accumulate, chunk_size doubles at a time. The lock is
+    // shared, so the cores accumulate at the same time (element-wise
+    // accumulates are atomic) and core 0 does not have to post any receive.
+    double reduce_begin = elapsed_seconds();
+    double cpu_begin = cpu_seconds();
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+    for(long long offset=0; offset<vector_size; offset+=chunk_size)
+    {
+        int len = offset+chunk_size<vector_size ? chunk_size : vector_size-offset;
+        MPI_Accumulate(vector_sum+offset, len, MPI_DOUBLE, 0, offset, len, MPI_DOUBLE, MPI_SUM, window);
+    }
+    MPI_Win_unlock(0, window); // the accumulates are complete at core 0
+    MPI_Barrier(MPI_COMM_WORLD);
+    // testing and printing out results
+    if(0 == my_rank)
+    {
+        double end = elapsed_seconds();
+        double cpu_time = cpu_seconds()-cpu_begin;
+        printf("Chunk size: %lld (%lld accumulates per core)\n", chunk_size, (vector_size+chunk_size-1)/chunk_size);
+        printf("Time taken: %f\n", end-begin);
+        printf("Reduction time: %f (core 0 CPU time: %f)\n", end-reduce_begin, cpu_time);
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+        MPI_Win_sync(window);
+        test_result(res_sum, vector_count, vector_size, 1); // test result
+        MPI_Win_unlock(0, window);
+    }
+
+    free(vector_sum);
+    MPI_Win_free(&window);
+    MPI_Finalize();
+    return 0;
+}
+
+double elapsed_seconds()
+{
+    struct timeval tv;
+    struct timezone tz;
+    gettimeofday(&tv, &tz);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+// user plus system time of this core
+double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1000000.0;
+}
+
+void test_result(double* vector_sum, long long vector_count, long long vector_size, int print_values)
+{
+    double res = (double)vector_size*(double)vector_count*(double)(vector_count-1)/(double)2;
+    for(long long i=0; i<vector_size; i++)
+    {
+        double expected = res+(double)i*(double)vector_count;
+        if(vector_sum[i] != expected)
+        {
+            printf("Wrong value at %lld\n", i);
+            printf("Expected: %.0f\n", expected);
+            printf("Actual: %.0f\n", vector_sum[i]);
+            exit(1);
+        }
+    }
+    if(!print_values)
+    {
+        return;
+    }
+    int iterSize = vector_size<30 ? vector_size : 30;
+    for(int i=0; i<iterSize; i++)
+    {
+        printf("%.0f, ", vector_sum[i]);
+    }
+    printf("\n");
+}
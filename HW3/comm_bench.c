@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <mpi.h>
+
+// every measurement moves about this many bytes, but runs at least
+// MIN_ITERATIONS and at most MAX_ITERATIONS times after one warmup round
+#define TARGET_BYTES (1ll << 30)
+#define MIN_ITERATIONS 3
+#define MAX_ITERATIONS 1000
+
+// tests of the benchmark, in the order they are run
+#define PING_PONG 0
+#define FLAT_REDUCE 1
+#define TREE_REDUCE 2
+#define MPI_REDUCE 3
+#define MPI_ALLREDUCE 4
+#define TEST_COUNT 5
+
+double elapsed_seconds();
+int iterations_for(long long bytes);
+double time_test(int test, double* buffer, double* temp, int count, int iterations, int my_rank, int p_size);
+void flat_reduce(double* vector_sum, double* temp_sum, int vector_size, int my_rank, int p_size);
+void tree_reduce(double* vector_sum, double* temp_sum, int vector_size, int my_rank, int p_size);
+void fit_alpha_beta(const long long* bytes, const double* times, int n, double* alpha, double* beta);
+
+int main(int argc, char** argv)
+{
+    // setting up MPI and broadcasting parameters
+    long long max_bytes = 256ll << 20;
+    int p_size, my_rank;
+    MPI_Init(NULL, NULL);
+    MPI_Comm_size(MPI_COMM_WORLD, &p_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    if(0 == my_rank)
+    {
+        struct option long_options[] =
+        {
+            {"max", required_argument, NULL, 'm'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        while(-1 != (optchar = getopt_long(argc, argv, "m:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 'm':
+                    max_bytes = strtoll(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        // the reduction tests use one MPI_DOUBLE count per message
+        if(0 != argc-optind || max_bytes < 8 || max_bytes/8 > 2147483647)
+        {
+            printf("Wrong number of arguments\n");
+            exit(1);
+        }
+    }
+    MPI_Bcast(&max_bytes, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    int max_count = max_bytes/8;
+    double* buffer = (double*) malloc(max_count*sizeof(double));
+    double* temp = (double*) malloc(max_count*sizeof(double));
+    memset(buffer, 0, max_count*sizeof(double));
+    memset(temp, 0, max_count*sizeof(double));
+
+    const char* names[TEST_COUNT] = {"ping-pong", "flat", "tree", "MPI_Reduce", "MPI_Allreduce"};
+    int size_count = 0;
+    for(long long bytes=8; bytes<=max_bytes; bytes*=2)
+    {
+        size_count++;
+    }
+    long long* sizes = (long long*) malloc(size_count*sizeof(long long));
+    double* times = (double*) malloc(TEST_COUNT*size_count*sizeof(double));
+    if(0 == my_rank)
+    {
+        printf("test, cores, bytes, iterations, seconds, MB/s\n");
+    }
+    for(int test=0; test<TEST_COUNT; test++)
+    {
+        if(PING_PONG == test && p_size < 2)
+        {
+            continue;
+        }
+        int s = 0;
+        for(long long bytes=8; bytes<=max_bytes; bytes*=2, s++)
+        {
+            int iterations = iterations_for(bytes);
+            double time = time_test(test, buffer, temp, bytes/8, iterations, my_rank, p_size);
+            sizes[s] = bytes;
+            times[test*size_count+s] = time;
+            if(0 == my_rank)
+            {
+                printf("%s, %d, %lld, %d, %e, %f\n", names[test], p_size, bytes, iterations, time, (double)bytes/time/1e6);
+                fflush(stdout);
+            }
+        }
+    }
+    // t(n) = alpha + beta*n for every test; for the ping-pong these are the
+    // latency and inverse bandwidth of the transport itself
+    if(0 == my_rank)
+    {
+        printf("\ntest, cores, alpha (us), beta (ns/byte), 1/beta (MB/s)\n");
+        for(int test=0; test<TEST_COUNT; test++)
+        {
+            if(PING_PONG == test && p_size < 2)
+            {
+                continue;
+            }
+            double alpha, beta;
+            fit_alpha_beta(sizes, times+test*size_count, size_count, &alpha, &beta);
+            printf("%s, %d, %f, %f, %f\n", names[test], p_size, alpha*1e6, beta*1e9, 1/beta/1e6);
+        }
+    }
+
+    free(times);
+    free(sizes);
+    free(temp);
+    free(buffer);
+    MPI_Finalize();
+    return 0;
+}
+
+int iterations_for(long long bytes)
+{
+    long long iterations = TARGET_BYTES/bytes;
+    if(iterations < MIN_ITERATIONS)
+    {
+        iterations = MIN_ITERATIONS;
+    }
+    if(iterations > MAX_ITERATIONS)
+    {
+        iterations = MAX_ITERATIONS;
+    }
+    return (int)iterations;
+}
+
+// Seconds per operation of count doubles. The ping-pong reports half of a
+// round trip between cores 0 and 1, the reductions the slowest core's
+// average over back to back operations.
+double time_test(int test, double* buffer, double* temp, int count, int iterations, int my_rank, int p_size)
+{
+    double begin = 0;
+    for(int it=-1; it<iterations; it++)
+    {
+        if(0 == it)
+        {
+            MPI_Barrier(MPI_COMM_WORLD); // the warmup round is not timed
+            begin = elapsed_seconds();
+        }
+        if(PING_PONG == test)
+        {
+            if(0 == my_rank)
+            {
+                MPI_Send(buffer, count, MPI_DOUBLE, 1, 0, MPI_COMM_WORLD);
+                MPI_Recv(buffer, count, MPI_DOUBLE, 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            }
+            else if(1 == my_rank)
+            {
+                MPI_Recv(buffer, count, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                MPI_Send(buffer, count, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+            }
+        }
+        else if(FLAT_REDUCE == test)
+        {
+            flat_reduce(buffer, temp, count, my_rank, p_size);
+        }
+        else if(TREE_REDUCE == test)
+        {
+            tree_reduce(buffer, temp, count, my_rank, p_size);
+        }
+        else if(MPI_REDUCE == test)
+        {
+            MPI_Reduce(buffer, temp, count, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        }
+        else
+        {
+            MPI_Allreduce(buffer, temp, count, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        }
+    }
+    double time = (elapsed_seconds()-begin)/iterations;
+    if(PING_PONG == test)
+    {
+        time /= 2;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return time;
+}
+
+// like flat_pi: every core sends its vector to core 0, which adds them one by one
+void flat_reduce(double* vector_sum, double* temp_sum, int vector_size, int my_rank, int p_size)
+{
+    if(0 != my_rank)
+    {
+        MPI_Send(vector_sum, vector_size, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+        return;
+    }
+    for(int source=1; source<p_size; source++)
+    {
+        MPI_Recv(temp_sum, vector_size, MPI_DOUBLE, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        for(int j=0; j<vector_size; j++)
+        {
+            vector_sum[j] += temp_sum[j];
+        }
+    }
+}
+
+// the binomial tree of tree_sum
+void tree_reduce(double* vector_sum, double* temp_sum, int vector_size, int my_rank, int p_size)
+{
+    int iterCount = ceil(log(p_size)/log(2));
+    int div = 2;
+    int pair = 1;
+    for(int i=0; i<iterCount; i++)
+    {
+        if(0 == my_rank%div && my_rank+pair<p_size)
+        {
+            MPI_Recv(temp_sum, vector_size, MPI_DOUBLE, my_rank+pair, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            for(int j=0; j<vector_size; j++)
+            {
+                vector_sum[j] += temp_sum[j];
+            }
+        }
+        else if(pair == my_rank%div)
+        {
+            MPI_Send(vector_sum, vector_size, MPI_DOUBLE, my_rank-pair, 0, MPI_COMM_WORLD);
+        }
+        div *= 2;
+        pair *= 2;
+    }
+}
+
+// Least squares fit of t = alpha + beta*n, weighted by 1/t^2 so that the
+// relative error counts: a plain fit would let the large messages decide
+// everything and leave alpha at the noise level of the biggest timings.
+void fit_alpha_beta(const long long* bytes, const double* times, int n, double* alpha, double* beta)
+{
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for(int k=0; k<n; k++)
+    {
+        double w = 1/(times[k]*times[k]);
+        double x = (double)bytes[k];
+        sw += w;
+        sx += w*x;
+        sy += w*times[k];
+        sxx += w*x*x;
+        sxy += w*x*times[k];
+    }
+    double det = sw*sxx - sx*sx;
+    *beta = (sw*sxy - sx*sy)/det;
+    *alpha = (sy - *beta*sx)/sw;
+}
+
+double elapsed_seconds()
+{
+    struct timeval tv;
+    struct timezone tz;
+    gettimeofday(&tv, &tz);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
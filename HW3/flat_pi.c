@@ -1,48 +1,104 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <sys/time.h>
 #include <math.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <omp.h>
 #include <mpi.h>
+#include "rng.h"
+#include "pi_kernel.h"
+#include "work_share.h"
 
 #define ull unsigned long long int 
 
-double rand01();
-double dist_to_origin(double x, double y);
 double elapsed_seconds();
+void print_memory_usage(int my_rank);
 
 int main(int argc, char** argv)
 {
     //setting up MPI and broadcasting parameter
     ull sample_size;
+    int thread_count = 1;
+    ull min_chunk = 0; // 0 means every core takes the same number of samples
+    ull seed;
     int p_size, my_rank;
+    int provided;
     double begin;
-    MPI_Init(NULL, NULL);
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size(MPI_COMM_WORLD, &p_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    // the OpenMP threads of -t run while only the main thread calls MPI
+    if(provided < MPI_THREAD_FUNNELED)
+    {
+        if(0 == my_rank)
+        {
+            printf("The MPI library does not support MPI_THREAD_FUNNELED\n");
+            fflush(stdout);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
     if(0 == my_rank)
     {
-        if(2 != argc)
+        struct option long_options[] =
+        {
+            {"threads", required_argument, NULL, 't'},
+            {"seed", required_argument, NULL, 'S'},
+            {"dynamic", required_argument, NULL, 'd'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        seed = rng_time_seed();
+        while(-1 != (optchar = getopt_long(argc, argv, "t:S:d:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 't':
+                    thread_count = strtol(optarg, NULL, 10);
+                    break;
+                case 'S':
+                    seed = strtoull(optarg, NULL, 10);
+                    break;
+                case 'd':
+                    min_chunk = strtoull(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(1 != argc-optind || thread_count < 1)
         {
             printf("Wrong number of arguments\n");
             exit(1);
         }
-        sample_size = strtoull(argv[1], NULL, 10);
+        sample_size = strtoull(argv[optind], NULL, 10);
     }
     MPI_Bcast(&sample_size, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&thread_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&min_chunk, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
     
     MPI_Barrier(MPI_COMM_WORLD);
     begin = elapsed_seconds();
-    // sampling
-    unsigned int seed = time(NULL)*(my_rank+1);
+    // sampling, every thread of every core takes sample_size samples
+    // from its own stream and the threads are summed up by the reduction clause.
+    // The stream number is the global thread number, so for a given seed the
+    // estimate only depends on cores*threads, not on how they are split.
+    // With -d the samples of all cores are handed out in chunks instead.
     ull in_circle_count = 0;
-    for(ull i=0; i<sample_size; i++)
+    if(0 < min_chunk)
+    {
+        in_circle_count = dynamic_count_in_circle((ull)p_size*thread_count*sample_size, min_chunk, thread_count, seed, my_rank, p_size);
+    }
+    else
     {
-        double x = rand01(&seed);
-        double y = rand01(&seed);
-        if(dist_to_origin(x, y) <= (double)1)
+        #pragma omp parallel num_threads(thread_count) reduction(+:in_circle_count)
         {
-            in_circle_count++;
+            rng_t rng;
+            rng_init(&rng, seed, (ull)my_rank*thread_count+omp_get_thread_num());
+            in_circle_count += pi_count_in_circle(&rng, sample_size);
         }
     }
     // sending result to core 0 and printing the final result
@@ -55,28 +111,41 @@ int main(int argc, char** argv)
             MPI_Recv(&temp, 1, MPI_UNSIGNED_LONG_LONG, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
             total_in_circle_count += temp;
         }
-        double pi_estimate = (double) 4 * (double) total_in_circle_count / (double) p_size / (double) sample_size;
+        double pi_estimate = (double) 4 * (double) total_in_circle_count / (double) p_size / (double) thread_count / (double) sample_size;
         double accuracy = fabs((M_PI-pi_estimate)/M_PI);
         double end = elapsed_seconds();
         printf("Estimate of pi: %f\n", pi_estimate);
         printf("Accuracy of estimation: %e\n", accuracy);
+        printf("Seed: %llu\n", seed);
+        printf("Cores x threads: %d x %d\n", p_size, thread_count);
+        printf("Sampling kernel: %s\n", pi_kernel_name());
         printf("Time taken: %f\n", end-begin);
+        printf("Samples per second per thread: %e\n", (double) sample_size / (end-begin));
     }
     else
     {
         MPI_Send(&in_circle_count, 1, MPI_UNSIGNED_LONG_LONG, 0, 0, MPI_COMM_WORLD);
     }
+    print_memory_usage(my_rank);
     MPI_Finalize();
     return 0;
 }
 
-double rand01(unsigned int* seed)
-{
-    return ((double) rand_r(seed)) / ((double) RAND_MAX);
-}
-double dist_to_origin(double x, double y)
+
+// peak resident memory of every core, summed and maxed on core 0, to compare
+// a cores x threads launch with the same number of single threaded cores
+void print_memory_usage(int my_rank)
 {
-    return sqrt(x*x + y*y);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long max_rss = usage.ru_maxrss; // in kilobytes on Linux
+    long total_rss, largest_rss;
+    MPI_Reduce(&max_rss, &total_rss, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&max_rss, &largest_rss, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(0 == my_rank)
+    {
+        printf("Peak memory (KB): %ld total, %ld largest core\n", total_rss, largest_rss);
+    }
 }
 
 double elapsed_seconds()
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "latency.h"
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+void print_latencies(double* latencies, long long iterations, const char* how)
+{
+    long long warmup = 1<iterations ? (iterations/10 > 1 ? iterations/10 : 1) : 0;
+    long long n = iterations-warmup;
+    double* steady = latencies+warmup;
+    double mean = 0;
+    for(long long k=0; k<n; k++)
+    {
+        mean += steady[k];
+    }
+    mean /= n;
+    qsort(steady, n, sizeof(double), compare_doubles);
+    // nearest rank: the smallest latency with at least p of the iterations at or below it
+    long long p50 = (n*50+99)/100-1;
+    long long p99 = (n*99+99)/100-1;
+    printf("Iterations: %lld (first %lld not counted%s%s)\n", iterations, warmup, NULL==how ? "" : ", ", NULL==how ? "" : how);
+    printf("Latency p50: %f us, p99: %f us, mean: %f us, min: %f us, max: %f us\n",
+        steady[p50]*1e6, steady[p99]*1e6, mean*1e6, steady[0]*1e6, steady[n-1]*1e6);
+}
@@ -0,0 +1,12 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+// Latency statistics for the --iterations mode of tree_sum and
+// MPI_Reduce_sum. latencies[k] is how long iteration k took, in seconds. The
+// first tenth of the iterations (at least one) warms up connections and
+// caches and is left out, the rest are sorted in place and their p50, p99,
+// mean, min and max are printed. how, if not NULL, says how the reduction
+// was repeated and is printed next to the number of iterations.
+void print_latencies(double* latencies, long long iterations, const char* how);
+
+#endif
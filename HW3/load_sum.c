@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sum_file.h"
+
+// Maps a vector written by "tree_sum -o" back into memory, checks its header
+// and every element against the expected sum (for the -z stride it was
+// written with), and prints the first 30 values like tree_sum does.
+int main(int argc, char** argv)
+{
+    if(2 != argc)
+    {
+        printf("Wrong number of arguments\n");
+        exit(1);
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if(-1 == fd)
+    {
+        printf("Can not open %s\n", argv[1]);
+        exit(1);
+    }
+    struct stat file_stat;
+    fstat(fd, &file_stat);
+    if((size_t)file_stat.st_size < sizeof(SumFileHeader))
+    {
+        printf("%s is too short for a header\n", argv[1]);
+        exit(1);
+    }
+    void* map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(MAP_FAILED == map)
+    {
+        printf("Can not map %s\n", argv[1]);
+        exit(1);
+    }
+    close(fd);
+
+    const SumFileHeader* header = (const SumFileHeader*) map;
+    if(0 != memcmp(header->magic, SUM_FILE_MAGIC, sizeof(header->magic)) || sizeof(double) != header->element_size)
+    {
+        printf("%s is not a vector sum file\n", argv[1]);
+        exit(1);
+    }
+    long long vector_size = header->vector_size;
+    long long vector_count = header->vector_count;
+    long long stride = 0==header->stride ? 1 : header->stride;
+    if((unsigned long long)file_stat.st_size != header->header_size + vector_size*sizeof(double))
+    {
+        printf("%s should have %llu bytes, it has %lld\n", argv[1],
+            (unsigned long long)(header->header_size + vector_size*sizeof(double)), (long long)file_stat.st_size);
+        exit(1);
+    }
+    const double* vector_sum = (const double*) ((const char*) map + header->header_size);
+    printf("Vector size: %lld, vector count: %lld, stride: %lld, written by %u cores\n", vector_size, vector_count, stride, header->writers);
+
+    for(long long i=0; i<vector_size; i++)
+    {
+        long long r = i%stride;
+        long long n = r<vector_count ? (vector_count-1-r)/stride + 1 : 0;
+        double expected = (double)vector_size*((double)n*(double)r + (double)stride*(double)n*(double)(n-1)/(double)2) + (double)i*(double)n;
+        if(vector_sum[i] != expected)
+        {
+            printf("Wrong value at %lld\n", i);
+            printf("Expected: %.0f\n", expected);
+            printf("Actual: %.0f\n", vector_sum[i]);
+            exit(1);
+        }
+    }
+    int iterSize = vector_size<30 ? vector_size : 30;
+    for(int i=0; i<iterSize; i++)
+    {
+        printf("%.0f, ", vector_sum[i]);
+    }
+    printf("\n");
+    munmap(map, file_stat.st_size);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _MAX_MESSAGE_H
+#define _MAX_MESSAGE_H
+
+// MPI counts are int and many MPI stacks fail on single messages above 2 GB,
+// so the vector programs send vectors in pieces of at most MAX_MESSAGE
+// doubles (512 MB)
+#define MAX_MESSAGE (1ll << 26)
+
+#endif
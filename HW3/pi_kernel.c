@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include "pi_kernel.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define ull unsigned long long int
+
+// points drawn per call to the generator, small enough to stay in L1
+#define PI_BLOCK 2048
+
+// A point is two 24-bit integers a, b scaled by 2^-24, and it is inside the
+// circle if a*a + b*b <= 2^48. Both sides are exact in a double, so there is
+// no sqrt, no rounding and no difference between the kernels below.
+#define RADIUS_SQUARED 281474976710656.0
+
+static ull count_scalar(const uint32_t* xs, const uint32_t* ys, int n)
+{
+    ull count = 0;
+    for(int k=0; k<n; k++)
+    {
+        double x = (double)(xs[k] >> 8);
+        double y = (double)(ys[k] >> 8);
+        count += (x*x + y*y <= RADIUS_SQUARED);
+    }
+    return count;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static ull count_avx2(const uint32_t* xs, const uint32_t* ys, int n)
+{
+    const __m256d radius = _mm256_set1_pd(RADIUS_SQUARED);
+    __m256i acc = _mm256_setzero_si256(); // one counter per 64-bit lane
+    int k;
+    for(k=0; k+8<=n; k+=8)
+    {
+        __m256i a = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(xs+k)), 8);
+        __m256i b = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(ys+k)), 8);
+        __m256d x0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(a));
+        __m256d x1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(a, 1));
+        __m256d y0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(b));
+        __m256d y1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1));
+        __m256d d0 = _mm256_add_pd(_mm256_mul_pd(x0, x0), _mm256_mul_pd(y0, y0));
+        __m256d d1 = _mm256_add_pd(_mm256_mul_pd(x1, x1), _mm256_mul_pd(y1, y1));
+        // an all-ones mask is -1, so subtracting it counts the hit
+        acc = _mm256_sub_epi64(acc, _mm256_castpd_si256(_mm256_cmp_pd(d0, radius, _CMP_LE_OQ)));
+        acc = _mm256_sub_epi64(acc, _mm256_castpd_si256(_mm256_cmp_pd(d1, radius, _CMP_LE_OQ)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_scalar(xs+k, ys+k, n-k);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static ull count_avx512(const uint32_t* xs, const uint32_t* ys, int n)
+{
+    const __m512d radius = _mm512_set1_pd(RADIUS_SQUARED);
+    ull count = 0;
+    int k;
+    for(k=0; k+16<=n; k+=16)
+    {
+        __m512i a = _mm512_srli_epi32(_mm512_loadu_si512(xs+k), 8);
+        __m512i b = _mm512_srli_epi32(_mm512_loadu_si512(ys+k), 8);
+        __m512d x0 = _mm512_cvtepi32_pd(_mm512_castsi512_si256(a));
+        __m512d x1 = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(a, 1));
+        __m512d y0 = _mm512_cvtepi32_pd(_mm512_castsi512_si256(b));
+        __m512d y1 = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(b, 1));
+        __m512d d0 = _mm512_add_pd(_mm512_mul_pd(x0, x0), _mm512_mul_pd(y0, y0));
+        __m512d d1 = _mm512_add_pd(_mm512_mul_pd(x1, x1), _mm512_mul_pd(y1, y1));
+        __mmask8 m0 = _mm512_cmp_pd_mask(d0, radius, _CMP_LE_OQ);
+        __mmask8 m1 = _mm512_cmp_pd_mask(d1, radius, _CMP_LE_OQ);
+        count += __builtin_popcount(m0 | ((unsigned)m1 << 8));
+    }
+    return count + count_scalar(xs+k, ys+k, n-k);
+}
+#endif
+
+typedef ull (*count_function)(const uint32_t*, const uint32_t*, int);
+
+static count_function pick_kernel(const char** name)
+{
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        *name = "avx512";
+        return count_avx512;
+    }
+    if(__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return count_avx2;
+    }
+#endif
+    *name = "scalar";
+    return count_scalar;
+}
+
+ull pi_count_in_circle(rng_t* rng, ull sample_count)
+{
+    const char* name;
+    count_function count_in_block = pick_kernel(&name);
+    uint32_t bits[2*PI_BLOCK];
+    ull count = 0;
+    for(ull done=0; done<sample_count; )
+    {
+        int len = sample_count-done<PI_BLOCK ? sample_count-done : PI_BLOCK;
+        // x coordinates in the first half of the block, y in the second
+        rng_fill_u32(rng, bits, 2*len);
+        count += count_in_block(bits, bits+len, len);
+        done += len;
+    }
+    return count;
+}
+
+const char* pi_kernel_name()
+{
+    const char* name;
+    pick_kernel(&name);
+    return name;
+}
@@ -0,0 +1,15 @@
+#ifndef _PI_KERNEL_H
+#define _PI_KERNEL_H
+
+#include "rng.h"
+
+// Sampling kernel shared by flat_pi, tree_pi and MPI_Reduce_pi. Draws
+// sample_count points from rng and returns how many fall in the unit circle.
+// Points are taken in blocks and tested with AVX-512, AVX2 or plain C code,
+// whichever the CPU supports. Every version gives the same count.
+unsigned long long pi_count_in_circle(rng_t* rng, unsigned long long sample_count);
+
+// name of the kernel pi_count_in_circle uses on this CPU
+const char* pi_kernel_name();
+
+#endif
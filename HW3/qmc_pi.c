@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <math.h>
+#include <getopt.h>
+#include <mpi.h>
+#include "rng.h"
+#include "pi_kernel.h"
+
+#define ull unsigned long long int
+
+// per-core points of the first round in the -e mode, doubled every round
+#define FIRST_ROUND 1024
+// streams of the seed used for scrambling, far away from the per-core streams
+#define SCRAMBLE_STREAM (1ull << 63)
+// points of the sequence a run may use: the direction numbers have 64 digits,
+// and keeping below 2^64 leaves n+1 nonzero for __builtin_ctzll
+#define SOBOL_POINTS (1ull << 63)
+
+// direction numbers of a 2-dimensional Sobol sequence after a random linear
+// scrambling, plus the random digital shift of the replicate
+typedef struct
+{
+    uint64_t v[2][64];
+    uint64_t shift[2];
+} Sobol;
+
+double elapsed_seconds();
+void sobol_init(Sobol* sobol, ull seed, int replicate);
+ull sobol_count_in_circle(const Sobol* sobol, ull first, ull count);
+void rqmc_estimate(const ull* in_circle_counts, int replicates, ull total_points, double* mean, double* std_error);
+void time_to_target(ull seed, int replicates, double target, ull max_size, int my_rank, int p_size);
+
+int main(int argc, char** argv)
+{
+    //setting up MPI and broadcasting parameter
+    ull sample_size;
+    int replicates = 8;
+    double target = 0; // 0 means a fixed sample_size run
+    ull seed;
+    int p_size, my_rank;
+    double begin;
+    MPI_Init(NULL, NULL);
+    MPI_Comm_size(MPI_COMM_WORLD, &p_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    if(0 == my_rank)
+    {
+        struct option long_options[] =
+        {
+            {"replicates", required_argument, NULL, 'r'},
+            {"target", required_argument, NULL, 'e'},
+            {"seed", required_argument, NULL, 'S'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        seed = rng_time_seed();
+        while(-1 != (optchar = getopt_long(argc, argv, "r:e:S:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 'r':
+                    replicates = strtol(optarg, NULL, 10);
+                    break;
+                case 'e':
+                    target = strtod(optarg, NULL);
+                    break;
+                case 'S':
+                    seed = strtoull(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(1 != argc-optind || replicates < 2 || target < 0)
+        {
+            printf("Wrong number of arguments\n");
+            exit(1);
+        }
+        sample_size = strtoull(argv[optind], NULL, 10);
+        // -e stops doubling at sample_size per core, so this bounds both modes
+        if(sample_size > SOBOL_POINTS/p_size)
+        {
+            printf("At most %llu points per core with %d cores\n", SOBOL_POINTS/p_size, p_size);
+            exit(1);
+        }
+    }
+    MPI_Bcast(&sample_size, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&replicates, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&target, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    if(0 < target)
+    {
+        time_to_target(seed, replicates, target, sample_size, my_rank, p_size);
+        MPI_Finalize();
+        return 0;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    begin = elapsed_seconds();
+    // sampling, core i takes points i*sample_size ... (i+1)*sample_size-1 of
+    // every scrambled sequence, so together the cores cover one prefix of it
+    ull* in_circle_counts = (ull*) malloc(replicates*sizeof(ull));
+    ull* total_in_circle_counts = (ull*) malloc(replicates*sizeof(ull));
+    for(int r=0; r<replicates; r++)
+    {
+        Sobol sobol;
+        sobol_init(&sobol, seed, r);
+        in_circle_counts[r] = sobol_count_in_circle(&sobol, (ull)my_rank*sample_size, sample_size);
+    }
+    // sending result to core 0 and printing the final result
+    MPI_Reduce(in_circle_counts, total_in_circle_counts, replicates, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(0 == my_rank)
+    {
+        double pi_estimate, std_error;
+        rqmc_estimate(total_in_circle_counts, replicates, (ull)p_size*sample_size, &pi_estimate, &std_error);
+        double accuracy = fabs((M_PI-pi_estimate)/M_PI);
+        double end = elapsed_seconds();
+        printf("Estimate of pi: %f\n", pi_estimate);
+        printf("Accuracy of estimation: %e\n", accuracy);
+        printf("Estimated relative error (%d scramblings): %e\n", replicates, std_error/pi_estimate);
+        printf("Seed: %llu\n", seed);
+        printf("Time taken: %f\n", end-begin);
+    }
+    free(total_in_circle_counts);
+    free(in_circle_counts);
+    MPI_Finalize();
+    return 0;
+}
+
+static uint64_t next_u64(rng_t* rng)
+{
+    uint64_t high = rng_next_u32(rng);
+    return high << 32 | rng_next_u32(rng);
+}
+
+// The first dimension is the van der Corput sequence in base 2, the second
+// one comes from the primitive polynomial x+1. Both are scrambled with a
+// random lower triangular matrix (Matousek's linear scrambling) and a random
+// digital shift. Every core builds the same scrambling from the seed.
+void sobol_init(Sobol* sobol, ull seed, int replicate)
+{
+    uint64_t m = 1;
+    for(int k=0; k<64; k++)
+    {
+        sobol->v[0][k] = 1ull << (63-k);
+        sobol->v[1][k] = m << (63-k);
+        m = (m << 1) ^ m;
+    }
+
+    rng_t rng;
+    rng_init(&rng, seed, SCRAMBLE_STREAM+replicate);
+    for(int d=0; d<2; d++)
+    {
+        // row i of the matrix turns digit i (bit 63-i) into the xor of
+        // itself and a random subset of the more significant digits
+        uint64_t rows[64];
+        for(int i=0; i<64; i++)
+        {
+            uint64_t digit = 1ull << (63-i);
+            uint64_t above = 0==i ? 0 : ~((digit << 1) - 1);
+            rows[i] = digit | (next_u64(&rng) & above);
+        }
+        for(int k=0; k<64; k++)
+        {
+            uint64_t scrambled = 0;
+            for(int i=0; i<64; i++)
+            {
+                scrambled |= (uint64_t)__builtin_parityll(rows[i] & sobol->v[d][k]) << (63-i);
+            }
+            sobol->v[d][k] = scrambled;
+        }
+        sobol->shift[d] = next_u64(&rng);
+    }
+}
+
+// Counts the points first ... first+count-1 (< SOBOL_POINTS) of the sequence
+// in Gray code order. Jumping to the first point is one xor per bit of its index, after
+// that every point is the previous one xor a single direction number.
+ull sobol_count_in_circle(const Sobol* sobol, ull first, ull count)
+{
+    uint64_t x = sobol->shift[0];
+    uint64_t y = sobol->shift[1];
+    ull gray = first ^ (first >> 1);
+    for(int k=0; gray; k++, gray >>= 1)
+    {
+        if(gray & 1)
+        {
+            x ^= sobol->v[0][k];
+            y ^= sobol->v[1][k];
+        }
+    }
+    // 26-bit coordinates keep a*a + b*b <= 2^52 exact in a double
+    ull in_circle_count = 0;
+    for(ull n=first; n<first+count; n++)
+    {
+        double a = (double)(x >> 38);
+        double b = (double)(y >> 38);
+        in_circle_count += (a*a + b*b <= 4503599627370496.0);
+        int k = __builtin_ctzll(n+1);
+        x ^= sobol->v[0][k];
+        y ^= sobol->v[1][k];
+    }
+    return in_circle_count;
+}
+
+// randomized QMC: the scramblings are independent, so their spread gives the
+// standard error of the mean estimate
+void rqmc_estimate(const ull* in_circle_counts, int replicates, ull total_points, double* mean, double* std_error)
+{
+    double sum = 0, sum_squares = 0;
+    for(int r=0; r<replicates; r++)
+    {
+        double estimate = (double) 4 * (double) in_circle_counts[r] / (double) total_points;
+        sum += estimate;
+        sum_squares += estimate*estimate;
+    }
+    *mean = sum/replicates;
+    double variance = (sum_squares - replicates*(*mean)*(*mean))/(replicates-1);
+    *std_error = sqrt(variance > 0 ? variance : 0)/sqrt(replicates);
+}
+
+// Keeps doubling the points until the estimated relative error is below
+// target, once with the scrambled Sobol points and once with the plain
+// pseudo random kernel, and reports how long each of them took. The plain
+// estimate uses the binomial standard error 4*sqrt(q*(1-q)/N), q = hits/N.
+void time_to_target(ull seed, int replicates, double target, ull max_size, int my_rank, int p_size)
+{
+    ull* in_circle_counts = (ull*) calloc(replicates, sizeof(ull));
+    ull* total_in_circle_counts = (ull*) malloc(replicates*sizeof(ull));
+    Sobol* sobols = (Sobol*) malloc(replicates*sizeof(Sobol));
+    for(int r=0; r<replicates; r++)
+    {
+        sobol_init(&sobols[r], seed, r);
+    }
+    const char* names[2] = {"scrambled Sobol", "pseudo random"};
+    for(int method=0; method<2; method++)
+    {
+        rng_t rng;
+        rng_init(&rng, seed, my_rank);
+        ull in_circle_count = 0, total_in_circle_count;
+        ull per_core = 0;   // points taken by every core so far
+        ull offset = 0;     // points of the sequence used by all cores so far
+        ull round = FIRST_ROUND;
+        double pi_estimate = 0, relative_error = 1;
+        MPI_Barrier(MPI_COMM_WORLD);
+        double begin = elapsed_seconds();
+        while(per_core < max_size)
+        {
+            if(per_core+round > max_size)
+            {
+                round = max_size-per_core;
+            }
+            if(0 == method)
+            {
+                // each round the cores take the next p_size*round points
+                for(int r=0; r<replicates; r++)
+                {
+                    in_circle_counts[r] += sobol_count_in_circle(&sobols[r], offset+(ull)my_rank*round, round);
+                }
+                MPI_Allreduce(in_circle_counts, total_in_circle_counts, replicates, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+            }
+            else
+            {
+                in_circle_count += pi_count_in_circle(&rng, round);
+                MPI_Allreduce(&in_circle_count, &total_in_circle_count, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+            }
+            per_core += round;
+            offset += (ull)p_size*round;
+            round = per_core; // doubles the total
+
+            if(0 == method)
+            {
+                double std_error;
+                rqmc_estimate(total_in_circle_counts, replicates, offset, &pi_estimate, &std_error);
+                relative_error = std_error/pi_estimate;
+            }
+            else
+            {
+                double q = (double) total_in_circle_count / (double) offset;
+                pi_estimate = 4*q;
+                relative_error = 4*sqrt(q*(1-q)/offset)/pi_estimate;
+            }
+            if(relative_error <= target)
+            {
+                break;
+            }
+        }
+        double end = elapsed_seconds();
+        if(0 == my_rank)
+        {
+            printf("%s:\n", names[method]);
+            printf("    Estimate of pi: %f\n", pi_estimate);
+            printf("    Accuracy of estimation: %e\n", fabs((M_PI-pi_estimate)/M_PI));
+            printf("    Estimated relative error: %e%s\n", relative_error, relative_error<=target ? "" : " (target not reached)");
+            if(0 == method)
+            {
+                printf("    Points per scrambling: %llu (x %d scramblings)\n", offset, replicates);
+            }
+            else
+            {
+                printf("    Points: %llu\n", offset);
+            }
+            printf("    Time to target: %f\n", end-begin);
+        }
+    }
+    if(0 == my_rank)
+    {
+        printf("Seed: %llu\n", seed);
+    }
+    free(sobols);
+    free(total_in_circle_counts);
+    free(in_circle_counts);
+}
+
+double elapsed_seconds()
+{
+    struct timeval tv;
+    struct timezone tz;
+    gettimeofday(&tv, &tz);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "repro_sum.h"
+
+// per thread, since in the threads build every core is a thread
+static _Thread_local double sigma[REPRO_FOLDS];
+
+void repro_setup(double max_abs, long long terms)
+{
+    int e, t = 0;
+    frexp(0 < max_abs ? max_abs : 1, &e); // max_abs < 2^e
+    while((1ll << t) < terms)
+    {
+        t++;
+    }
+    // Level k adds at most terms parts of at most 2^(e+t) in total, so with
+    // sigma = 1.5*2^(e+t+2) the accumulator stays within [1.25, 1.75]*2^(e+t+2)
+    // and its ulp, 2^(e+t-50), is fixed. A remainder is at most half an ulp,
+    // which sets the bound of the next level.
+    int exponent = e + t + 2;
+    for(int k=0; k<REPRO_FOLDS; k++)
+    {
+        sigma[k] = ldexp(1.5, exponent);
+        exponent += t + 2 - 53;
+    }
+}
+
+void repro_block_zero(double* s)
+{
+    for(int k=0; k<REPRO_FOLDS; k++)
+    {
+        for(int j=0; j<REPRO_BLOCK; j++)
+        {
+            s[k*REPRO_BLOCK+j] = sigma[k];
+        }
+    }
+}
+
+// Rounding s+r to the grid is exact except for ties, where round to even
+// would look at s. Setting the lowest bit of a nonzero r (the grid is at least
+// 8 ulps of r) means r is never a tie. Zeros are left alone so that they do
+// not turn into denormals.
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// two elements at a time
+static void block_add_sse2(double* s, const double* x)
+{
+    const __m128d low_bit = _mm_castsi128_pd(_mm_set1_epi64x(1));
+    const __m128d zero = _mm_setzero_pd();
+    for(int j=0; j<REPRO_BLOCK; j+=2)
+    {
+        __m128d r = _mm_loadu_pd(x+j);
+        for(int k=0; k<REPRO_FOLDS; k++)
+        {
+            __m128d odd = _mm_or_pd(r, _mm_and_pd(_mm_cmpneq_pd(r, zero), low_bit));
+            __m128d old = _mm_loadu_pd(s+k*REPRO_BLOCK+j);
+            __m128d sum = _mm_add_pd(old, odd);
+            _mm_storeu_pd(s+k*REPRO_BLOCK+j, sum);
+            r = _mm_sub_pd(r, _mm_sub_pd(sum, old));
+        }
+    }
+}
+
+// and four at a time
+__attribute__((target("avx")))
+static void block_add_avx(double* s, const double* x)
+{
+    const __m256d low_bit = _mm256_castsi256_pd(_mm256_set1_epi64x(1));
+    const __m256d zero = _mm256_setzero_pd();
+    for(int j=0; j<REPRO_BLOCK; j+=4)
+    {
+        __m256d r = _mm256_loadu_pd(x+j);
+        for(int k=0; k<REPRO_FOLDS; k++)
+        {
+            __m256d odd = _mm256_or_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, zero, _CMP_NEQ_OQ), low_bit));
+            __m256d old = _mm256_loadu_pd(s+k*REPRO_BLOCK+j);
+            __m256d sum = _mm256_add_pd(old, odd);
+            _mm256_storeu_pd(s+k*REPRO_BLOCK+j, sum);
+            r = _mm256_sub_pd(r, _mm256_sub_pd(sum, old));
+        }
+    }
+}
+#else
+static void block_add_scalar(double* s, const double* x)
+{
+    for(int j=0; j<REPRO_BLOCK; j++)
+    {
+        double r = x[j];
+        for(int k=0; k<REPRO_FOLDS; k++)
+        {
+            uint64_t bits;
+            memcpy(&bits, &r, sizeof(bits));
+            bits |= (uint64_t)(0 != r);
+            double odd;
+            memcpy(&odd, &bits, sizeof(odd));
+            double old = s[k*REPRO_BLOCK+j];
+            double sum = old + odd;
+            s[k*REPRO_BLOCK+j] = sum;
+            r -= sum - old;
+        }
+    }
+}
+#endif
+
+void repro_block_add(double* s, const double* x)
+{
+#if defined(__x86_64__)
+    static int isa = -1; // 1 = AVX, 0 = SSE2
+    if(isa < 0)
+    {
+        isa = __builtin_cpu_supports("avx") ? 1 : 0;
+    }
+    if(1 == isa)
+    {
+        block_add_avx(s, x);
+    }
+    else
+    {
+        block_add_sse2(s, x);
+    }
+#else
+    block_add_scalar(s, x);
+#endif
+}
+
+void repro_block_store(const double* s, double* acc, long long len)
+{
+    for(long long j=0; j<len; j++)
+    {
+        for(int k=0; k<REPRO_FOLDS; k++)
+        {
+            acc[j*REPRO_FOLDS+k] = s[k*REPRO_BLOCK+j];
+        }
+    }
+}
+
+void repro_add_vectors(double* acc, long long start_i, long long end_i, long long vector_size, long long stride, double scale)
+{
+    double* block = (double*) malloc(REPRO_FOLDS*REPRO_BLOCK*sizeof(double));
+    double* values = (double*) malloc(REPRO_BLOCK*sizeof(double));
+    for(long long first=0; first<vector_size; first+=REPRO_BLOCK)
+    {
+        long long len = vector_size-first<REPRO_BLOCK ? vector_size-first : REPRO_BLOCK;
+        repro_block_zero(block);
+        memset(values, 0, REPRO_BLOCK*sizeof(double));
+        for(long long i=start_i; i<end_i; i++)
+        {
+            if(1 < stride)
+            {
+                memset(values, 0, len*sizeof(double));
+            }
+            for(long long j=first+(i%stride-first%stride+stride)%stride; j<first+len; j+=stride)
+            {
+                values[j-first] = ((double)i*(double)vector_size + (double)j)*scale;
+            }
+            repro_block_add(block, values);
+        }
+        repro_block_store(block, acc+first*REPRO_FOLDS, len);
+    }
+    free(values);
+    free(block);
+}
+
+void repro_merge(const double* in, double* inout, long long n)
+{
+    for(long long j=0; j<n; j++)
+    {
+        for(int k=0; k<REPRO_FOLDS; k++)
+        {
+            inout[j*REPRO_FOLDS+k] += in[j*REPRO_FOLDS+k] - sigma[k];
+        }
+    }
+}
+
+void repro_finish(const double* acc, double* out, long long n)
+{
+    for(long long j=0; j<n; j++)
+    {
+        double sum = 0;
+        for(int k=0; k<REPRO_FOLDS; k++)
+        {
+            sum += acc[j*REPRO_FOLDS+k] - sigma[k];
+        }
+        out[j] = sum;
+    }
+}
+
+#ifndef THREAD_MPI
+static void repro_op(void* in, void* inout, int* len, MPI_Datatype* type)
+{
+    repro_merge((const double*) in, (double*) inout, *len);
+}
+
+void repro_mpi_create(MPI_Datatype* type, MPI_Op* op)
+{
+    MPI_Type_contiguous(REPRO_FOLDS, MPI_DOUBLE, type);
+    MPI_Type_commit(type);
+    MPI_Op_create(repro_op, 1, op); // the merge is exact, so it commutes
+}
+
+void repro_mpi_free(MPI_Datatype* type, MPI_Op* op)
+{
+    MPI_Op_free(op);
+    MPI_Type_free(type);
+}
+#endif
+
+uint64_t repro_hash(const double* v, long long n)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(long long j=0; j<n; j++)
+    {
+        uint64_t bits;
+        memcpy(&bits, v+j, sizeof(bits));
+        for(int b=0; b<8; b++)
+        {
+            hash ^= (bits >> (8*b)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
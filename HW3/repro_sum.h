@@ -0,0 +1,62 @@
+#ifndef _REPRO_SUM_H
+#define _REPRO_SUM_H
+
+#include <stdint.h>
+#ifdef THREAD_MPI
+#include "thread_mpi.h"
+#else
+#include <mpi.h>
+#endif
+
+// Reproducible sums for "tree_sum -r" and "MPI_Reduce_sum -r". Every element
+// of the sum is kept as REPRO_FOLDS accumulators s_k = sigma_k + (a multiple
+// of ulp(sigma_k)). A value is split over the levels by rounding it to the
+// grid of level 0, adding that part exactly, and passing the remainder on to
+// the next level; what is left after the last level is dropped. All the
+// additions are exact, so the accumulators do not depend on the order the
+// values come in, on the number of cores or on the shape of the tree, and
+// neither does the final sum of the levels.
+//
+// The sigmas come from a bound on |value| and on the number of values, so
+// every core has to call repro_setup with the same arguments (take the max
+// of the local bounds with MPI_Allreduce first). Each level resolves about
+// 51 - log2(terms) more bits below 4*terms*max_abs.
+#define REPRO_FOLDS 3
+
+// values are accumulated in blocks of this many elements, one row of
+// REPRO_BLOCK doubles per level, so the loops have a fixed length and vectorize
+#define REPRO_BLOCK 1024
+
+void repro_setup(double max_abs, long long terms);
+
+// s is a block: REPRO_FOLDS rows of REPRO_BLOCK accumulators
+void repro_block_zero(double* s);
+// adds x[0 ... REPRO_BLOCK-1] into the block, pad unused positions with 0
+void repro_block_add(double* s, const double* x);
+// copies the first len elements of the block to acc, REPRO_FOLDS doubles
+// per element (the layout of the MPI datatype and of repro_merge)
+void repro_block_store(const double* s, double* acc, long long len);
+
+// the vectors start_i ... end_i-1 of tree_sum and MPI_Reduce_sum (see
+// add_vectors in tree_sum.c) straight into acc, REPRO_FOLDS doubles per
+// element. The vector is done one block at a time, so the block of
+// accumulators stays in cache while all the vectors go through it.
+void repro_add_vectors(double* acc, long long start_i, long long end_i, long long vector_size, long long stride, double scale);
+
+// inout += in for n elements of REPRO_FOLDS doubles each
+void repro_merge(const double* in, double* inout, long long n);
+// the sums of n elements of acc, level 0 first
+void repro_finish(const double* acc, double* out, long long n);
+
+// REPRO_FOLDS contiguous doubles and a commutative MPI_Op doing repro_merge,
+// for MPI_Reduce and MPI_Allreduce. Call after repro_setup. Not in the
+// threads build, which has no user-defined types and ops.
+#ifndef THREAD_MPI
+void repro_mpi_create(MPI_Datatype* type, MPI_Op* op);
+void repro_mpi_free(MPI_Datatype* type, MPI_Op* op);
+#endif
+
+// FNV-1a of the bits of v, to compare results between runs
+uint64_t repro_hash(const double* v, long long n);
+
+#endif
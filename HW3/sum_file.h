@@ -0,0 +1,24 @@
+#ifndef _SUM_FILE_H
+#define _SUM_FILE_H
+
+#include <stdint.h>
+
+// Layout of the file written by "tree_sum -o": this 64 byte header, then
+// vector_size doubles of the summed vector starting at byte header_size.
+// Numbers are in the byte order of the machine that wrote the file.
+
+#define SUM_FILE_MAGIC "VECSUM1"
+
+typedef struct
+{
+    char magic[8];          // SUM_FILE_MAGIC with its terminating zero
+    uint64_t header_size;   // byte offset of the first element
+    uint64_t vector_size;   // number of elements
+    uint64_t vector_count;  // number of vectors that were summed
+    uint32_t element_size;  // sizeof(double)
+    uint32_t writers;       // number of cores that wrote a slice
+    uint64_t stride;        // the -z input stride, 0 in files without it
+    uint64_t reserved[2];
+} SumFileHeader;
+
+#endif
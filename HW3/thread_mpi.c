@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "thread_mpi.h"
+
+// One send. It lives in the sender's stack frame or request until the
+// receiver has copied data and set done.
+typedef struct message
+{
+    struct message* _Atomic next; // link in the mailbox queue
+    struct message* pending_next; // link in the receiver's list of unmatched messages
+    int source;
+    int tag;
+    const void* data;
+    size_t bytes;
+    atomic_int done;
+} message;
+
+// The mailbox of a core is an intrusive multi-producer single-consumer queue
+// (Vyukov): a sender swaps its message into head and then links the previous
+// head to it, the owner takes messages from tail. Messages the owner took out
+// but could not match yet wait in its private pending list, in arrival order.
+typedef struct
+{
+    _Alignas(64) message* _Atomic head;
+    _Alignas(64) message* tail;
+    message stub;
+    message* pending_first;
+    message* pending_last;
+} mailbox;
+
+#define SEND_REQUEST 0
+#define RECV_REQUEST 1
+
+struct thread_mpi_request
+{
+    int kind;
+    int persistent;
+    int active;
+    message message;      // of a send
+    void* buffer;         // of a receive
+    size_t bytes;
+    int source;
+    int tag;
+};
+
+static int world_size;
+static mailbox* mailboxes;
+static pthread_barrier_t barrier;
+static const void** slots; // buffers of the collective in progress, one per core
+static _Thread_local int world_rank;
+static int saved_argc;
+static char** saved_argv;
+
+static size_t type_size(MPI_Datatype type)
+{
+    switch(type)
+    {
+        case MPI_INT: return sizeof(int);
+        case MPI_LONG: return sizeof(long);
+        case MPI_LONG_LONG: return sizeof(long long);
+        case MPI_UNSIGNED_LONG_LONG: return sizeof(unsigned long long);
+        case MPI_DOUBLE: return sizeof(double);
+        default: return 1;
+    }
+}
+
+// lets the other threads run while this one waits, the machine may have
+// fewer CPUs than cores
+static void pause_thread()
+{
+    sched_yield();
+}
+
+static void unsupported(const char* name)
+{
+    fprintf(stderr, "%s is not available in the threads build\n", name);
+    exit(1);
+}
+
+static void mailbox_push(mailbox* box, message* m)
+{
+    atomic_store_explicit(&m->next, NULL, memory_order_relaxed);
+    message* prev = atomic_exchange_explicit(&box->head, m, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, m, memory_order_release);
+}
+
+// the oldest message of the queue, NULL if there is none (or a sender is
+// between its two steps)
+static message* mailbox_pop(mailbox* box)
+{
+    message* tail = box->tail;
+    message* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(&box->stub == tail)
+    {
+        if(NULL == next)
+        {
+            return NULL;
+        }
+        box->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if(NULL != next)
+    {
+        box->tail = next;
+        return tail;
+    }
+    if(tail != atomic_load_explicit(&box->head, memory_order_acquire))
+    {
+        return NULL;
+    }
+    // tail is the last message, put the stub behind it so it can be taken
+    mailbox_push(box, &box->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(NULL != next)
+    {
+        box->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int matches(const message* m, int source, int tag)
+{
+    return (MPI_ANY_SOURCE == source || m->source == source) && (MPI_ANY_TAG == tag || m->tag == tag);
+}
+
+// the first message of this core from source with tag, waiting for it if
+// needed. It stays in the pending list; previous is its predecessor there.
+static message* find_message(int source, int tag, message** previous)
+{
+    mailbox* box = mailboxes+world_rank;
+    message* prev = NULL;
+    for(message* m=box->pending_first; NULL!=m; prev=m, m=m->pending_next)
+    {
+        if(matches(m, source, tag))
+        {
+            *previous = prev;
+            return m;
+        }
+    }
+    while(1)
+    {
+        message* m = mailbox_pop(box);
+        if(NULL == m)
+        {
+            pause_thread();
+            continue;
+        }
+        m->pending_next = NULL;
+        if(NULL == box->pending_last)
+        {
+            box->pending_first = m;
+        }
+        else
+        {
+            box->pending_last->pending_next = m;
+        }
+        *previous = box->pending_last;
+        box->pending_last = m;
+        if(matches(m, source, tag))
+        {
+            return m;
+        }
+    }
+}
+
+static void fill_status(MPI_Status* status, int source, int tag, size_t bytes)
+{
+    if(MPI_STATUS_IGNORE != status)
+    {
+        status->MPI_SOURCE = source;
+        status->MPI_TAG = tag;
+        status->MPI_ERROR = MPI_SUCCESS;
+        status->bytes = bytes;
+    }
+}
+
+static void receive(void* buf, size_t bytes, int source, int tag, MPI_Status* status)
+{
+    if(MPI_PROC_NULL == source)
+    {
+        fill_status(status, MPI_PROC_NULL, MPI_ANY_TAG, 0);
+        return;
+    }
+    mailbox* box = mailboxes+world_rank;
+    message* prev;
+    message* m = find_message(source, tag, &prev);
+    if(NULL == prev)
+    {
+        box->pending_first = m->pending_next;
+    }
+    else
+    {
+        prev->pending_next = m->pending_next;
+    }
+    if(box->pending_last == m)
+    {
+        box->pending_last = prev;
+    }
+    size_t len = m->bytes<bytes ? m->bytes : bytes;
+    memcpy(buf, m->data, len);
+    fill_status(status, m->source, m->tag, len);
+    atomic_store_explicit(&m->done, 1, memory_order_release); // the sender may reuse its buffer
+}
+
+static void post_send(message* m, const void* buf, size_t bytes, int dest, int tag)
+{
+    m->source = world_rank;
+    m->tag = tag;
+    m->data = buf;
+    m->bytes = bytes;
+    atomic_store_explicit(&m->done, MPI_PROC_NULL==dest, memory_order_relaxed);
+    if(MPI_PROC_NULL != dest)
+    {
+        mailbox_push(mailboxes+dest, m);
+    }
+}
+
+static void wait_send(message* m)
+{
+    while(!atomic_load_explicit(&m->done, memory_order_acquire))
+    {
+        pause_thread();
+    }
+}
+
+static void* rank_thread(void* arg)
+{
+    world_rank = (int)(intptr_t)arg;
+    thread_mpi_main(saved_argc, saved_argv);
+    return NULL;
+}
+
+#undef main
+int main(int argc, char** argv)
+{
+    const char* size = getenv("THREAD_MPI_SIZE");
+    world_size = NULL!=size ? atoi(size) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(world_size < 1)
+    {
+        world_size = 1;
+    }
+    saved_argc = argc;
+    saved_argv = argv;
+    mailboxes = (mailbox*) aligned_alloc(64, world_size*sizeof(mailbox));
+    slots = (const void**) malloc(world_size*sizeof(void*));
+    for(int r=0; r<world_size; r++)
+    {
+        mailbox* box = mailboxes+r;
+        atomic_store(&box->stub.next, NULL);
+        atomic_store(&box->head, &box->stub);
+        box->tail = &box->stub;
+        box->pending_first = NULL;
+        box->pending_last = NULL;
+    }
+    pthread_barrier_init(&barrier, NULL, world_size);
+    // core 0 is the main thread
+    pthread_t* threads = (pthread_t*) malloc(world_size*sizeof(pthread_t));
+    for(int r=1; r<world_size; r++)
+    {
+        pthread_create(threads+r, NULL, rank_thread, (void*)(intptr_t)r);
+    }
+    rank_thread((void*)(intptr_t)0);
+    for(int r=1; r<world_size; r++)
+    {
+        pthread_join(threads[r], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(slots);
+    free(mailboxes);
+    return 0;
+}
+
+int MPI_Init(int* argc, char*** argv)
+{
+    return MPI_SUCCESS;
+}
+
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided)
+{
+    *provided = required;
+    return MPI_SUCCESS;
+}
+
+int MPI_Finalize()
+{
+    return MPI_Barrier(MPI_COMM_WORLD);
+}
+
+int MPI_Abort(MPI_Comm comm, int code)
+{
+    exit(code);
+}
+
+int MPI_Comm_size(MPI_Comm comm, int* size)
+{
+    *size = world_size;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_rank(MPI_Comm comm, int* rank)
+{
+    *rank = world_rank;
+    return MPI_SUCCESS;
+}
+
+double MPI_Wtime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+{
+    message m;
+    post_send(&m, buf, count*type_size(type), dest, tag);
+    wait_send(&m);
+    return MPI_SUCCESS;
+}
+
+int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status* status)
+{
+    receive(buf, count*type_size(type), source, tag, status);
+    return MPI_SUCCESS;
+}
+
+int MPI_Send_init(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request)
+{
+    struct thread_mpi_request* r = (struct thread_mpi_request*) malloc(sizeof(struct thread_mpi_request));
+    r->kind = SEND_REQUEST;
+    r->persistent = 1;
+    r->active = 0;
+    r->buffer = (void*) buf;
+    r->bytes = count*type_size(type);
+    r->source = dest;
+    r->tag = tag;
+    *request = r;
+    return MPI_SUCCESS;
+}
+
+int MPI_Recv_init(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request)
+{
+    MPI_Send_init(buf, count, type, source, tag, comm, request);
+    (*request)->kind = RECV_REQUEST;
+    return MPI_SUCCESS;
+}
+
+int MPI_Start(MPI_Request* request)
+{
+    struct thread_mpi_request* r = *request;
+    r->active = 1;
+    if(SEND_REQUEST == r->kind)
+    {
+        post_send(&r->message, r->buffer, r->bytes, r->source, r->tag);
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Startall(int count, MPI_Request* requests)
+{
+    for(int k=0; k<count; k++)
+    {
+        MPI_Start(requests+k);
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request)
+{
+    MPI_Send_init(buf, count, type, dest, tag, comm, request);
+    (*request)->persistent = 0;
+    return MPI_Start(request);
+}
+
+int MPI_Irecv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request)
+{
+    MPI_Recv_init(buf, count, type, source, tag, comm, request);
+    (*request)->persistent = 0;
+    return MPI_Start(request);
+}
+
+int MPI_Wait(MPI_Request* request, MPI_Status* status)
+{
+    struct thread_mpi_request* r = *request;
+    if(MPI_REQUEST_NULL == r)
+    {
+        return MPI_SUCCESS;
+    }
+    if(r->active)
+    {
+        if(SEND_REQUEST == r->kind)
+        {
+            wait_send(&r->message);
+            fill_status(status, world_rank, r->tag, r->bytes);
+        }
+        else
+        {
+            receive(r->buffer, r->bytes, r->source, r->tag, status);
+        }
+        r->active = 0;
+    }
+    if(!r->persistent)
+    {
+        free(r);
+        *request = MPI_REQUEST_NULL;
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Waitall(int count, MPI_Request* requests, MPI_Status* statuses)
+{
+    for(int k=0; k<count; k++)
+    {
+        MPI_Wait(requests+k, MPI_STATUSES_IGNORE==statuses ? MPI_STATUS_IGNORE : statuses+k);
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Request_free(MPI_Request* request)
+{
+    MPI_Wait(request, MPI_STATUS_IGNORE);
+    free(*request);
+    *request = MPI_REQUEST_NULL;
+    return MPI_SUCCESS;
+}
+
+int MPI_Sendrecv(const void* send_buf, int send_count, MPI_Datatype send_type, int dest, int send_tag,
+    void* recv_buf, int recv_count, MPI_Datatype recv_type, int source, int recv_tag, MPI_Comm comm, MPI_Status* status)
+{
+    message m;
+    post_send(&m, send_buf, send_count*type_size(send_type), dest, send_tag);
+    receive(recv_buf, recv_count*type_size(recv_type), source, recv_tag, status);
+    wait_send(&m);
+    return MPI_SUCCESS;
+}
+
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status* status)
+{
+    message* prev;
+    message* m = find_message(source, tag, &prev);
+    fill_status(status, m->source, m->tag, m->bytes);
+    return MPI_SUCCESS;
+}
+
+int MPI_Get_count(const MPI_Status* status, MPI_Datatype type, int* count)
+{
+    *count = (int)(status->bytes/type_size(type));
+    return MPI_SUCCESS;
+}
+
+int MPI_Barrier(MPI_Comm comm)
+{
+    pthread_barrier_wait(&barrier);
+    return MPI_SUCCESS;
+}
+
+int MPI_Bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm)
+{
+    if(root == world_rank)
+    {
+        slots[root] = buf;
+    }
+    pthread_barrier_wait(&barrier);
+    if(root != world_rank)
+    {
+        memcpy(buf, slots[root], count*type_size(type));
+    }
+    pthread_barrier_wait(&barrier); // root's buffer is read
+    return MPI_SUCCESS;
+}
+
+#define COMBINE(T) \
+    for(int k=0; k<count; k++) \
+    { \
+        T x = ((const T*) in)[k]; \
+        T* y = ((T*) inout)+k; \
+        *y = MPI_SUM==op ? *y+x : MPI_MAX==op ? (x>*y ? x : *y) : (x<*y ? x : *y); \
+    }
+
+static void combine(const void* in, void* inout, int count, MPI_Datatype type, MPI_Op op)
+{
+    switch(type)
+    {
+        case MPI_INT: COMBINE(int) break;
+        case MPI_LONG: COMBINE(long) break;
+        case MPI_LONG_LONG: COMBINE(long long) break;
+        case MPI_UNSIGNED_LONG_LONG: COMBINE(unsigned long long) break;
+        case MPI_DOUBLE: COMBINE(double) break;
+        default: COMBINE(unsigned char) break;
+    }
+}
+
+// the inputs of all cores combined in core order into a new buffer
+static void* reduce_slots(int count, MPI_Datatype type, MPI_Op op)
+{
+    size_t bytes = count*type_size(type);
+    void* result = malloc(0<bytes ? bytes : 1);
+    memcpy(result, slots[0], bytes);
+    for(int r=1; r<world_size; r++)
+    {
+        combine(slots[r], result, count, type, op);
+    }
+    return result;
+}
+
+int MPI_Reduce(const void* send_buf, void* recv_buf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm)
+{
+    slots[world_rank] = MPI_IN_PLACE==send_buf ? recv_buf : send_buf;
+    pthread_barrier_wait(&barrier);
+    if(root == world_rank)
+    {
+        void* result = reduce_slots(count, type, op);
+        memcpy(recv_buf, result, count*type_size(type));
+        free(result);
+    }
+    pthread_barrier_wait(&barrier); // every input is read
+    return MPI_SUCCESS;
+}
+
+int MPI_Allreduce(const void* send_buf, void* recv_buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    slots[world_rank] = MPI_IN_PLACE==send_buf ? recv_buf : send_buf;
+    pthread_barrier_wait(&barrier);
+    void* result = reduce_slots(count, type, op);
+    pthread_barrier_wait(&barrier); // every input is read before recv_buf changes
+    memcpy(recv_buf, result, count*type_size(type));
+    free(result);
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm* new_comm)
+{
+    unsupported("MPI_Comm_split");
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_split_type(MPI_Comm comm, int split_type, int key, MPI_Info info, MPI_Comm* new_comm)
+{
+    unsupported("MPI_Comm_split_type");
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_free(MPI_Comm* comm)
+{
+    unsupported("MPI_Comm_free");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm, void* base, MPI_Win* win)
+{
+    unsupported("MPI_Win_allocate_shared");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint* size, int* disp_unit, void* base)
+{
+    unsupported("MPI_Win_shared_query");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_lock_all(int assert, MPI_Win win)
+{
+    unsupported("MPI_Win_lock_all");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_unlock_all(MPI_Win win)
+{
+    unsupported("MPI_Win_unlock_all");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_sync(MPI_Win win)
+{
+    unsupported("MPI_Win_sync");
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_free(MPI_Win* win)
+{
+    unsupported("MPI_Win_free");
+    return MPI_SUCCESS;
+}
+
+int MPI_File_open(MPI_Comm comm, const char* name, int mode, MPI_Info info, MPI_File* file)
+{
+    unsupported("MPI_File_open");
+    return MPI_SUCCESS;
+}
+
+int MPI_File_set_size(MPI_File file, MPI_Offset size)
+{
+    unsupported("MPI_File_set_size");
+    return MPI_SUCCESS;
+}
+
+int MPI_File_write_at_all(MPI_File file, MPI_Offset offset, const void* buf, int count, MPI_Datatype type, MPI_Status* status)
+{
+    unsupported("MPI_File_write_at_all");
+    return MPI_SUCCESS;
+}
+
+int MPI_File_close(MPI_File* file)
+{
+    unsupported("MPI_File_close");
+    return MPI_SUCCESS;
+}
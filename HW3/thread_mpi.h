@@ -0,0 +1,122 @@
+#ifndef _THREAD_MPI_H
+#define _THREAD_MPI_H
+
+#include <stddef.h>
+
+// Threads backend for the HW3 programs: built with -DTHREAD_MPI, tree_sum and
+// tree_pi include this header instead of <mpi.h> and every core becomes a
+// thread of one process, so no mpirun is needed. The number of cores comes
+// from the THREAD_MPI_SIZE environment variable (default: the number of
+// online CPUs). thread_mpi.c has the real main, which starts the threads and
+// runs the program's main (renamed below) in every one of them.
+//
+// A send puts a pointer to its buffer into the lock-free mailbox of the
+// receiver, and the receiver copies straight out of the sender's buffer, so
+// a message is copied once. Sends therefore complete only when they are
+// received (MPI allows this), and an MPI_Irecv is matched when it is waited
+// for, so nonblocking receives from one source have to be waited for in the
+// order they were posted. Collectives meet in a table of buffer pointers
+// between barriers.
+//
+// Only MPI_COMM_WORLD exists. Communicator splits, windows and MPI-IO are
+// here so that the programs compile, but abort when called; the programs
+// reject the options that need them.
+
+typedef int MPI_Comm;
+typedef int MPI_Datatype;
+typedef int MPI_Op;
+typedef int MPI_Info;
+typedef int MPI_Win;
+typedef int MPI_File;
+typedef long MPI_Aint;
+typedef long long MPI_Offset;
+typedef struct thread_mpi_request* MPI_Request;
+typedef struct
+{
+    int MPI_SOURCE;
+    int MPI_TAG;
+    int MPI_ERROR;
+    size_t bytes;
+} MPI_Status;
+
+#define MPI_SUCCESS 0
+#define MPI_COMM_WORLD 0
+#define MPI_COMM_NULL (-1)
+#define MPI_INFO_NULL 0
+#define MPI_WIN_NULL (-1)
+#define MPI_UNDEFINED (-32766)
+#define MPI_PROC_NULL (-2)
+#define MPI_ANY_SOURCE (-3)
+#define MPI_ANY_TAG (-1)
+#define MPI_COMM_TYPE_SHARED 1
+#define MPI_MODE_NOCHECK 1024
+#define MPI_MODE_CREATE 1
+#define MPI_MODE_WRONLY 4
+#define MPI_THREAD_SINGLE 0
+#define MPI_THREAD_FUNNELED 1
+#define MPI_IN_PLACE ((void*) 1)
+#define MPI_STATUS_IGNORE ((MPI_Status*) 0)
+#define MPI_STATUSES_IGNORE ((MPI_Status*) 0)
+#define MPI_REQUEST_NULL ((MPI_Request) 0)
+
+#define MPI_CHAR 1
+#define MPI_BYTE 2
+#define MPI_INT 3
+#define MPI_LONG 4
+#define MPI_LONG_LONG 5
+#define MPI_UNSIGNED_LONG_LONG 6
+#define MPI_DOUBLE 7
+
+#define MPI_SUM 1
+#define MPI_MAX 2
+#define MPI_MIN 3
+
+// the program's main runs once per core, thread_mpi.c has the process main
+#define main thread_mpi_main
+int thread_mpi_main(int argc, char** argv);
+
+int MPI_Init(int* argc, char*** argv);
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided);
+int MPI_Finalize();
+int MPI_Abort(MPI_Comm comm, int code);
+int MPI_Comm_size(MPI_Comm comm, int* size);
+int MPI_Comm_rank(MPI_Comm comm, int* rank);
+double MPI_Wtime();
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm);
+int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status* status);
+int MPI_Isend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request);
+int MPI_Irecv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request);
+int MPI_Sendrecv(const void* send_buf, int send_count, MPI_Datatype send_type, int dest, int send_tag,
+    void* recv_buf, int recv_count, MPI_Datatype recv_type, int source, int recv_tag, MPI_Comm comm, MPI_Status* status);
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status* status);
+int MPI_Get_count(const MPI_Status* status, MPI_Datatype type, int* count);
+int MPI_Send_init(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request);
+int MPI_Recv_init(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request);
+int MPI_Start(MPI_Request* request);
+int MPI_Startall(int count, MPI_Request* requests);
+int MPI_Wait(MPI_Request* request, MPI_Status* status);
+int MPI_Waitall(int count, MPI_Request* requests, MPI_Status* statuses);
+int MPI_Request_free(MPI_Request* request);
+
+int MPI_Barrier(MPI_Comm comm);
+int MPI_Bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm);
+int MPI_Reduce(const void* send_buf, void* recv_buf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm);
+int MPI_Allreduce(const void* send_buf, void* recv_buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm);
+
+// not available with threads, these abort
+int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm* new_comm);
+int MPI_Comm_split_type(MPI_Comm comm, int split_type, int key, MPI_Info info, MPI_Comm* new_comm);
+int MPI_Comm_free(MPI_Comm* comm);
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm, void* base, MPI_Win* win);
+int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint* size, int* disp_unit, void* base);
+int MPI_Win_lock_all(int assert, MPI_Win win);
+int MPI_Win_unlock_all(MPI_Win win);
+int MPI_Win_sync(MPI_Win win);
+int MPI_Win_free(MPI_Win* win);
+int MPI_File_open(MPI_Comm comm, const char* name, int mode, MPI_Info info, MPI_File* file);
+int MPI_File_set_size(MPI_File file, MPI_Offset size);
+int MPI_File_write_at_all(MPI_File file, MPI_Offset offset, const void* buf, int count, MPI_Datatype type, MPI_Status* status);
+int MPI_File_close(MPI_File* file);
+
+#endif
@@ -1,90 +1,261 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <sys/time.h>
 #include <math.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <omp.h>
+#ifdef THREAD_MPI
+#include "thread_mpi.h"
+#else
 #include <mpi.h>
+#endif
+#include "rng.h"
+#include "pi_kernel.h"
+#ifndef THREAD_MPI
+#include "work_share.h"
+#endif
 
 #define ull unsigned long long int 
 
-double rand01();
-double dist_to_origin(double x, double y);
 double elapsed_seconds();
+void print_memory_usage(int my_rank);
+void tree_reduce(ull* in_circle_count, int my_rank, int p_size, MPI_Comm comm);
+void node_reduce(ull* in_circle_count, MPI_Comm node_comm, MPI_Win node_window);
 
 int main(int argc, char** argv)
 {
     //setting up MPI and broadcasting parameter
     ull sample_size;
+    int thread_count = 1;
+    ull min_chunk = 0; // 0 means every core takes the same number of samples
+    int node_aware = 0;
+    ull seed;
     int p_size, my_rank;
+    int provided;
     double begin;
-    MPI_Init(NULL, NULL);
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size(MPI_COMM_WORLD, &p_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    // the OpenMP threads of -t run while only the main thread calls MPI
+    if(provided < MPI_THREAD_FUNNELED)
+    {
+        if(0 == my_rank)
+        {
+            printf("The MPI library does not support MPI_THREAD_FUNNELED\n");
+            fflush(stdout);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
     if(0 == my_rank)
     {
-        if(2 != argc)
+        struct option long_options[] =
+        {
+            {"threads", required_argument, NULL, 't'},
+            {"seed", required_argument, NULL, 'S'},
+            {"dynamic", required_argument, NULL, 'd'},
+            {"node-aware", no_argument, NULL, 'n'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        seed = rng_time_seed();
+        while(-1 != (optchar = getopt_long(argc, argv, "t:S:d:n", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 't':
+                    thread_count = strtol(optarg, NULL, 10);
+                    break;
+                case 'S':
+                    seed = strtoull(optarg, NULL, 10);
+                    break;
+                case 'd':
+                    min_chunk = strtoull(optarg, NULL, 10);
+                    break;
+                case 'n':
+                    node_aware = 1;
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(1 != argc-optind || thread_count < 1)
         {
             printf("Wrong number of arguments\n");
             exit(1);
         }
-        sample_size = strtoull(argv[1], NULL, 10);
+#ifdef THREAD_MPI
+        if(0 < min_chunk || node_aware)
+        {
+            printf("-d and -n need MPI windows, which the threads build does not have\n");
+            exit(1);
+        }
+#endif
+        sample_size = strtoull(argv[optind], NULL, 10);
     }
     MPI_Bcast(&sample_size, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
-    
+    MPI_Bcast(&thread_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&min_chunk, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&node_aware, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    // with -n the counts of a node meet in a shared window and only the node
+    // leaders take part in the tree, set up once outside the timing
+    MPI_Comm node_comm = MPI_COMM_NULL, leader_comm = MPI_COMM_NULL;
+    MPI_Win node_window = MPI_WIN_NULL;
+    ull* node_count = NULL;
+    if(node_aware)
+    {
+        int node_rank;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_split(MPI_COMM_WORLD, 0==node_rank ? 0 : MPI_UNDEFINED, my_rank, &leader_comm);
+        MPI_Win_allocate_shared(sizeof(ull), sizeof(ull), MPI_INFO_NULL, node_comm, &node_count, &node_window);
+    }
+
     MPI_Barrier(MPI_COMM_WORLD);
     begin = elapsed_seconds();
-    // sampling
-    unsigned int seed = time(NULL)*(my_rank+1);
+    // sampling, every thread of every core takes sample_size samples
+    // from its own stream and the threads are summed up by the reduction clause.
+    // The stream number is the global thread number, so for a given seed the
+    // estimate only depends on cores*threads, not on how they are split.
+    // With -d the samples of all cores are handed out in chunks instead.
     ull in_circle_count = 0;
-    for(ull i=0; i<sample_size; i++)
+#ifndef THREAD_MPI
+    if(0 < min_chunk)
+    {
+        in_circle_count = dynamic_count_in_circle((ull)p_size*thread_count*sample_size, min_chunk, thread_count, seed, my_rank, p_size);
+    }
+    else
+#endif
     {
-        double x = rand01(&seed);
-        double y = rand01(&seed);
-        if(dist_to_origin(x, y) <= (double)1)
+        #pragma omp parallel num_threads(thread_count) reduction(+:in_circle_count)
         {
-            in_circle_count++;
+            rng_t rng;
+            rng_init(&rng, seed, (ull)my_rank*thread_count+omp_get_thread_num());
+            in_circle_count += pi_count_in_circle(&rng, sample_size);
         }
     }
     // sending result to core 0
-    int iterCount = ceil(log(p_size)/log(2));
-    int div = 2;
-    int pair = 1;
-    for(int i=0; i<iterCount; i++)
+    if(node_aware)
     {
-        if(0 == my_rank%div && my_rank+pair<p_size)
-        {
-            ull temp;
-            MPI_Recv(&temp, 1, MPI_UNSIGNED_LONG_LONG, my_rank+pair, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            in_circle_count += temp;
-        }
-        else if(pair == my_rank%div)
+        *node_count = in_circle_count;
+        node_reduce(node_count, node_comm, node_window);
+        in_circle_count = *node_count;
+        if(MPI_COMM_NULL != leader_comm)
         {
-            MPI_Send(&in_circle_count, 1, MPI_UNSIGNED_LONG_LONG, my_rank-pair, 0, MPI_COMM_WORLD);
+            int leader_rank, leader_size;
+            MPI_Comm_rank(leader_comm, &leader_rank);
+            MPI_Comm_size(leader_comm, &leader_size);
+            tree_reduce(&in_circle_count, leader_rank, leader_size, leader_comm);
         }
-        div *= 2;
-        pair *= 2;
+    }
+    else
+    {
+        tree_reduce(&in_circle_count, my_rank, p_size, MPI_COMM_WORLD);
     }
     // printing the final result
     if(0 == my_rank)
     {
-        double pi_estimate = (double) 4 * (double) in_circle_count / (double) p_size / (double) sample_size;
+        double pi_estimate = (double) 4 * (double) in_circle_count / (double) p_size / (double) thread_count / (double) sample_size;
         double accuracy = fabs((M_PI-pi_estimate)/M_PI);
         double end = elapsed_seconds();
         printf("Estimate of pi: %f\n", pi_estimate);
         printf("Accuracy of estimation: %e\n", accuracy);
+        printf("Seed: %llu\n", seed);
+        printf("Cores x threads: %d x %d\n", p_size, thread_count);
+        printf("Sampling kernel: %s\n", pi_kernel_name());
         printf("Time taken: %f\n", end-begin);
+        printf("Samples per second per thread: %e\n", (double) sample_size / (end-begin));
+    }
+    print_memory_usage(my_rank);
+    if(node_aware)
+    {
+        MPI_Win_free(&node_window);
+        if(MPI_COMM_NULL != leader_comm)
+        {
+            MPI_Comm_free(&leader_comm);
+        }
+        MPI_Comm_free(&node_comm);
     }
     MPI_Finalize();
     return 0;
 }
 
-double rand01(unsigned int* seed)
+// binomial tree: at round i, ranks that are multiples of 2^(i+1) receive the
+// count of rank+2^i and add it to their own
+void tree_reduce(ull* in_circle_count, int my_rank, int p_size, MPI_Comm comm)
+{
+    int iterCount = ceil(log(p_size)/log(2));
+    int div = 2;
+    int pair = 1;
+    for(int i=0; i<iterCount; i++)
+    {
+        if(0 == my_rank%div && my_rank+pair<p_size)
+        {
+            ull temp;
+            MPI_Recv(&temp, 1, MPI_UNSIGNED_LONG_LONG, my_rank+pair, 0, comm, MPI_STATUS_IGNORE);
+            *in_circle_count += temp;
+        }
+        else if(pair == my_rank%div)
+        {
+            MPI_Send(in_circle_count, 1, MPI_UNSIGNED_LONG_LONG, my_rank-pair, 0, comm);
+        }
+        div *= 2;
+        pair *= 2;
+    }
+}
+
+// first level of the -n reduction: every core of the node has stored its
+// count in its slot of the shared window, the leader (node rank 0) adds the
+// other slots of the node into its own straight from memory
+void node_reduce(ull* in_circle_count, MPI_Comm node_comm, MPI_Win node_window)
 {
-    return ((double) rand_r(seed)) / ((double) RAND_MAX);
+    int node_rank, node_size;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    // the barrier orders the stores of the other cores before the loads
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, node_window);
+    MPI_Win_sync(node_window);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(node_window);
+    if(0 == node_rank)
+    {
+        for(int r=1; r<node_size; r++)
+        {
+            MPI_Aint slot_bytes;
+            int disp_unit;
+            ull* slot;
+            MPI_Win_shared_query(node_window, r, &slot_bytes, &disp_unit, &slot);
+            *in_circle_count += *slot;
+        }
+    }
+    MPI_Win_unlock_all(node_window);
 }
-double dist_to_origin(double x, double y)
+
+// peak resident memory of every core, summed and maxed on core 0, to compare
+// a cores x threads launch with the same number of single threaded cores
+void print_memory_usage(int my_rank)
 {
-    return sqrt(x*x + y*y);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long max_rss = usage.ru_maxrss; // in kilobytes on Linux
+#ifdef THREAD_MPI
+    // every core is a thread of this one process, whose peak covers them all
+    if(0 == my_rank)
+    {
+        printf("Peak memory (KB): %ld for the one process of all cores\n", max_rss);
+    }
+#else
+    long total_rss, largest_rss;
+    MPI_Reduce(&max_rss, &total_rss, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&max_rss, &largest_rss, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(0 == my_rank)
+    {
+        printf("Peak memory (KB): %ld total, %ld largest core\n", total_rss, largest_rss);
+    }
+#endif
 }
 
 double elapsed_seconds()
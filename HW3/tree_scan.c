@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <string.h>
+#include <getopt.h>
+#include <mpi.h>
+#include "max_message.h"
+
+// values of the -a option
+#define TREE_SCAN 0
+#define CHAIN_SCAN 1
+#define MPI_SCAN 2
+#define ALL_SCANS 3
+
+double elapsed_seconds();
+void add_vectors(double* vector_sum, long long start_i, long long end_i, long long vector_size);
+void send_vector(const double* vector, long long vector_size, int dest);
+void recv_add_vector(double* target, double* second_target, double* temp, long long vector_size, int source);
+void tree_scan(const double* partial_sum, double* prefix, double* up_sum, double* temp, long long vector_size, int inclusive, int my_rank, int p_size);
+void chain_scan(const double* partial_sum, double* prefix, double* up_sum, double* buffers, long long vector_size, long long segment_size, int inclusive, int my_rank, int p_size);
+void mpi_scan(const double* partial_sum, double* prefix, long long vector_size, int inclusive, int my_rank);
+double time_scan(int algorithm, int inclusive, const double* partial_sum, double* prefix, double* up_sum, double* temp,
+    long long vector_size, long long segment_size, int my_rank, int p_size);
+long long test_prefix(const double* prefix, long long vectors_below, long long vector_size);
+
+int main(int argc, char** argv)
+{
+    // setting up MPI and broadcasting parameters
+    long long vector_count, vector_size;
+    long long segment_size = 0; // 0 means the chain sends the whole vector at once
+    int algorithm = TREE_SCAN;
+    int inclusive = 1;
+    int p_size, my_rank;
+    long long start_i, end_i;
+    MPI_Init(NULL, NULL);
+    MPI_Comm_size(MPI_COMM_WORLD, &p_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    if(0 == my_rank)
+    {
+        struct option long_options[] =
+        {
+            {"algorithm", required_argument, NULL, 'a'},
+            {"exclusive", no_argument, NULL, 'e'},
+            {"segment", required_argument, NULL, 's'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        while(-1 != (optchar = getopt_long(argc, argv, "a:es:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 'a':
+                    if(0 == strcmp(optarg, "tree")) algorithm = TREE_SCAN;
+                    else if(0 == strcmp(optarg, "chain")) algorithm = CHAIN_SCAN;
+                    else if(0 == strcmp(optarg, "mpi")) algorithm = MPI_SCAN;
+                    else if(0 == strcmp(optarg, "all")) algorithm = ALL_SCANS;
+                    else
+                    {
+                        printf("Unknown scan algorithm: %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
+                case 'e':
+                    inclusive = 0;
+                    break;
+                case 's':
+                    segment_size = strtoll(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(2 != argc-optind || segment_size < 0)
+        {
+            printf("Wrong number of arguments\n");
+            exit(1);
+        }
+        vector_count = strtoll(argv[optind], NULL, 10);
+        vector_size = strtoll(argv[optind+1], NULL, 10);
+    }
+    MPI_Bcast(&vector_count, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&vector_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&segment_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&algorithm, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&inclusive, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(0 == segment_size || vector_size < segment_size)
+    {
+        segment_size = vector_size;
+    }
+    if(MAX_MESSAGE < segment_size)
+    {
+        segment_size = MAX_MESSAGE;
+    }
+    // distributing vectors to add, core r holds vectors start_i ... end_i-1,
+    // so its prefix is the sum of the vectors below end_i (inclusive) or
+    // below start_i (exclusive)
+    if(my_rank < vector_count%p_size)
+    {
+        long long temp = vector_count/p_size;
+        start_i = my_rank * temp + my_rank;
+        end_i = start_i + temp + 1;
+    }
+    else
+    {
+        long long temp = vector_count/p_size;
+        start_i = my_rank * temp + vector_count%p_size;
+        end_i = start_i + temp;
+    }
+
+    // every buffer is allocated once, outside the timing
+    double* partial_sum = (double*) malloc(vector_size*sizeof(double));
+    double* prefix = (double*) malloc(vector_size*sizeof(double));
+    double* up_sum = (double*) malloc(vector_size*sizeof(double));
+    long long temp_size = vector_size<MAX_MESSAGE ? vector_size : MAX_MESSAGE;
+    double* temp = (double*) malloc((2*segment_size>temp_size ? 2*segment_size : temp_size)*sizeof(double));
+    double begin = elapsed_seconds();
+    add_vectors(partial_sum, start_i, end_i, vector_size);
+    double add_time = elapsed_seconds()-begin;
+
+    const char* names[ALL_SCANS] = {"tree", "chain", "mpi"};
+    int first = ALL_SCANS==algorithm ? 0 : algorithm;
+    int last = ALL_SCANS==algorithm ? ALL_SCANS-1 : algorithm;
+    long long total_wrong = 0;
+    if(ALL_SCANS == algorithm && 0 == my_rank)
+    {
+        printf("algorithm, scan, cores, vector_size, segment_size, seconds\n");
+    }
+    for(int a=first; a<=last; a++)
+    {
+        for(int incl=1; incl>=0; incl--)
+        {
+            if(ALL_SCANS != algorithm && incl != inclusive)
+            {
+                continue;
+            }
+            if(ALL_SCANS == algorithm)
+            {
+                // warmup, so the connections of this algorithm exist
+                time_scan(a, incl, partial_sum, prefix, up_sum, temp, vector_size, segment_size, my_rank, p_size);
+            }
+            double time = time_scan(a, incl, partial_sum, prefix, up_sum, temp, vector_size, segment_size, my_rank, p_size);
+            long long wrong = test_prefix(prefix, incl ? end_i : start_i, vector_size);
+            MPI_Allreduce(MPI_IN_PLACE, &wrong, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+            total_wrong += wrong;
+            if(0 != my_rank)
+            {
+                continue;
+            }
+            if(ALL_SCANS == algorithm)
+            {
+                printf("%s, %s, %d, %lld, %lld, %e\n", names[a], incl ? "inclusive" : "exclusive", p_size, vector_size, segment_size, time);
+            }
+            else
+            {
+                if(CHAIN_SCAN == a && segment_size < vector_size)
+                {
+                    printf("Segment size: %lld (%lld segments)\n", segment_size, (vector_size+segment_size-1)/segment_size);
+                }
+                printf("Algorithm: %s (%s scan)\n", names[a], incl ? "inclusive" : "exclusive");
+                printf("Time taken: %f\n", add_time+time);
+                printf("Scan time: %f (slowest core)\n", time);
+            }
+            if(0 != wrong)
+            {
+                printf("Wrong prefix in %lld elements\n", wrong);
+            }
+        }
+    }
+    if(0 == total_wrong && 0 == my_rank)
+    {
+        printf("All %d cores hold their prefix of %lld vectors\n", p_size, vector_count);
+    }
+
+    free(temp);
+    free(up_sum);
+    free(prefix);
+    free(partial_sum);
+    MPI_Finalize();
+    return 0;
+}
+
+double elapsed_seconds()
+{
+    struct timeval tv;
+    struct timezone tz;
+    gettimeofday(&tv, &tz);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+// vector i has the elements i*vector_size + j
+void add_vectors(double* vector_sum, long long start_i, long long end_i, long long vector_size)
+{
+    memset(vector_sum, 0, vector_size*sizeof(double));
+    for(long long i=start_i; i<end_i; i++)
+    {
+        for(long long j=0; j<vector_size; j++)
+        {
+            vector_sum[j] += (double)i*(double)vector_size + (double)j;
+        }
+    }
+}
+
+void send_vector(const double* vector, long long vector_size, int dest)
+{
+    for(long long offset=0; offset<vector_size; offset+=MAX_MESSAGE)
+    {
+        int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+        MPI_Send(vector+offset, len, MPI_DOUBLE, dest, 0, MPI_COMM_WORLD);
+    }
+}
+
+// receives a vector from source in pieces and adds it into target and, if
+// it is not NULL, into second_target too
+void recv_add_vector(double* target, double* second_target, double* temp, long long vector_size, int source)
+{
+    for(long long offset=0; offset<vector_size; offset+=MAX_MESSAGE)
+    {
+        int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+        MPI_Recv(temp, len, MPI_DOUBLE, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        for(int j=0; j<len; j++)
+        {
+            target[offset+j] += temp[j];
+        }
+        if(NULL != second_target)
+        {
+            for(int j=0; j<len; j++)
+            {
+                second_target[offset+j] += temp[j];
+            }
+        }
+    }
+}
+
+// Work efficient scan on a binomial tree, 2*log(p) steps.
+// Up: at step d = 1, 2, 4, ... core r with (r+1)%(2d) == 0 receives the sum
+// of cores r-2d+1 ... r-d from core r-d, so afterwards up_sum holds the sum of
+// the lowbit(r+1) cores ending at r, and prefix the part of it below r.
+// Down: at step d = ..., 4, 2, 1 core r with (r+1)%(2d) == 0 knows its
+// inclusive prefix and sends it to core r+d, whose up_sum starts right after
+// r, so adding it completes the prefix of r+d.
+void tree_scan(const double* partial_sum, double* prefix, double* up_sum, double* temp, long long vector_size, int inclusive, int my_rank, int p_size)
+{
+    memcpy(up_sum, partial_sum, vector_size*sizeof(double));
+    memset(prefix, 0, vector_size*sizeof(double));
+    int d;
+    for(d=1; d<p_size; d*=2)
+    {
+        if(0 == (my_rank+1)%(2*d))
+        {
+            recv_add_vector(up_sum, prefix, temp, vector_size, my_rank-d);
+        }
+        else if(d == (my_rank+1)%(2*d) && my_rank+d < p_size)
+        {
+            send_vector(up_sum, vector_size, my_rank+d);
+        }
+    }
+    int have_inclusive = 0;
+    for(d/=2; d>=1; d/=2)
+    {
+        if(0 == (my_rank+1)%(2*d) && my_rank+d < p_size)
+        {
+            // this core's inclusive prefix, in up_sum which is not needed any
+            // more, computed once for all the cores it is sent to
+            if(!have_inclusive)
+            {
+                for(long long j=0; j<vector_size; j++)
+                {
+                    up_sum[j] = prefix[j] + partial_sum[j];
+                }
+                have_inclusive = 1;
+            }
+            send_vector(up_sum, vector_size, my_rank+d);
+        }
+        else if(d == (my_rank+1)%(2*d) && 0 <= my_rank-d)
+        {
+            recv_add_vector(prefix, NULL, temp, vector_size, my_rank-d);
+        }
+    }
+    if(inclusive)
+    {
+        for(long long j=0; j<vector_size; j++)
+        {
+            prefix[j] += partial_sum[j];
+        }
+    }
+}
+
+// Pipelined scan along the chain 0 -> 1 -> ... -> p-1. Core r receives the
+// inclusive prefix of core r-1 one segment at a time, adds its own partial
+// sum and passes the segment on, so after the pipeline has filled every core
+// works on a different segment. buffers holds two segments, the next one is
+// received while the current one is added. The inclusive prefix is sent from
+// prefix, or from up_sum for the exclusive scan.
+void chain_scan(const double* partial_sum, double* prefix, double* up_sum, double* buffers, long long vector_size, long long segment_size, int inclusive, int my_rank, int p_size)
+{
+    long long segment_count = (vector_size+segment_size-1)/segment_size;
+    MPI_Request recv_reqs[2];
+    MPI_Request* send_reqs = (MPI_Request*) malloc((segment_count+1)*sizeof(MPI_Request));
+    if(0 < my_rank && 0 < segment_count)
+    {
+        int len = segment_count>1 ? segment_size : vector_size;
+        MPI_Irecv(buffers, len, MPI_DOUBLE, my_rank-1, 0, MPI_COMM_WORLD, &recv_reqs[0]);
+    }
+    for(long long s=0; s<segment_count; s++)
+    {
+        long long offset = s*segment_size;
+        int len = offset+segment_size<vector_size ? segment_size : vector_size-offset;
+        double* below = NULL; // the exclusive prefix of this segment, NULL on core 0
+        if(0 < my_rank)
+        {
+            if(s+1 < segment_count)
+            {
+                long long next_offset = offset+segment_size;
+                int next_len = next_offset+segment_size<vector_size ? segment_size : vector_size-next_offset;
+                MPI_Irecv(buffers+((s+1)%2)*segment_size, next_len, MPI_DOUBLE, my_rank-1, 0, MPI_COMM_WORLD, &recv_reqs[(s+1)%2]);
+            }
+            MPI_Wait(&recv_reqs[s%2], MPI_STATUS_IGNORE);
+            below = buffers+(s%2)*segment_size;
+        }
+        double* send = inclusive ? prefix : up_sum;
+        for(int j=0; j<len; j++)
+        {
+            double exclusive = NULL==below ? 0 : below[j];
+            send[offset+j] = exclusive + partial_sum[offset+j];
+            if(!inclusive)
+            {
+                prefix[offset+j] = exclusive;
+            }
+        }
+        if(my_rank+1 < p_size)
+        {
+            MPI_Isend(send+offset, len, MPI_DOUBLE, my_rank+1, 0, MPI_COMM_WORLD, &send_reqs[s]);
+        }
+    }
+    if(my_rank+1 < p_size)
+    {
+        MPI_Waitall(segment_count, send_reqs, MPI_STATUSES_IGNORE);
+    }
+    free(send_reqs);
+}
+
+// MPI_Scan or MPI_Exscan in pieces of MAX_MESSAGE. MPI_Exscan leaves the
+// result on core 0 undefined, so it is set to zero there.
+void mpi_scan(const double* partial_sum, double* prefix, long long vector_size, int inclusive, int my_rank)
+{
+    for(long long offset=0; offset<vector_size; offset+=MAX_MESSAGE)
+    {
+        int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+        if(inclusive)
+        {
+            MPI_Scan(partial_sum+offset, prefix+offset, len, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        }
+        else
+        {
+            MPI_Exscan(partial_sum+offset, prefix+offset, len, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        }
+    }
+    if(!inclusive && 0 == my_rank)
+    {
+        memset(prefix, 0, vector_size*sizeof(double));
+    }
+}
+
+// seconds the slowest core spends in one scan, from a barrier
+double time_scan(int algorithm, int inclusive, const double* partial_sum, double* prefix, double* up_sum, double* temp,
+    long long vector_size, long long segment_size, int my_rank, int p_size)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    double begin = elapsed_seconds();
+    if(TREE_SCAN == algorithm)
+    {
+        tree_scan(partial_sum, prefix, up_sum, temp, vector_size, inclusive, my_rank, p_size);
+    }
+    else if(CHAIN_SCAN == algorithm)
+    {
+        chain_scan(partial_sum, prefix, up_sum, temp, vector_size, segment_size, inclusive, my_rank, p_size);
+    }
+    else
+    {
+        mpi_scan(partial_sum, prefix, vector_size, inclusive, my_rank);
+    }
+    double time = elapsed_seconds()-begin;
+    MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return time;
+}
+
+// The sum of vectors 0 ... m-1 has the elements
+// vector_size*m*(m-1)/2 + j*m. Returns the number of wrong elements.
+long long test_prefix(const double* prefix, long long vectors_below, long long vector_size)
+{
+    double m = (double)vectors_below;
+    double res = (double)vector_size*m*(m-1)/(double)2;
+    long long wrong = 0;
+    for(long long j=0; j<vector_size; j++)
+    {
+        if(prefix[j] != res+(double)j*m)
+        {
+            wrong++;
+        }
+    }
+    return wrong;
+}
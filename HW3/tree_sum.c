@@ -1,97 +1,1183 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <string.h>
 #include <math.h>
+#include <getopt.h>
+#ifdef THREAD_MPI
+#include "thread_mpi.h"
+#else
 #include <mpi.h>
+#endif
+#include "sum_file.h"
+#include "vector_codec.h"
+#include "repro_sum.h"
+#include "latency.h"
+#include "max_message.h"
 
 double elapsed_seconds();
-void test_result(double* vector_sum, int vector_count, int vector_size);
+double cpu_seconds();
+void test_result(double* vector_sum, long long vector_count, long long vector_size, long long stride, int print_values);
+void test_slice(double* slice, long long first, long long length, long long vector_count, long long vector_size, long long stride);
+double expected_value(long long i, long long vector_count, long long vector_size, long long stride);
+void print_error(double* vector_sum, long long vector_count, long long vector_size, long long stride, double scale);
+void add_vectors(double* vector_sum, long long start_i, long long end_i, long long vector_size, long long stride, double scale);
+void sendrecv_vector(double* send, long long send_size, int dest, double* recv, long long recv_size, int source, double* temp_sum, MPI_Comm comm);
+void mpi_allreduce(double* vector_sum, long long vector_size);
+void tree_reduce(double* vector_sum, long long vector_size, int my_rank, int p_size, MPI_Comm comm);
+void pipelined_tree_reduce(double* vector_sum, long long vector_size, long long segment_size, int my_rank, int p_size, MPI_Comm comm);
+void recursive_doubling_allreduce(double* vector_sum, long long vector_size, int my_rank, int p_size);
+void ring_blocks(long long vector_size, int p_size, long long* counts, long long* displs);
+void ring_reduce_scatter(double* vector_sum, const long long* counts, const long long* displs, double* temp_sum, int my_rank, int p_size);
+void ring_allreduce(double* vector_sum, long long vector_size, int my_rank, int p_size);
+void write_slice(const char* output_file, double* slice, long long first, long long length, long long max_length,
+    long long vector_count, long long vector_size, long long stride, int my_rank, int p_size);
+void allreduce_sweep(long long vector_count, long long max_size, long long start_i, long long end_i, int my_rank, int p_size);
+void node_reduce(long long vector_size, MPI_Comm node_comm, MPI_Win node_window);
+long long sparse_tree_reduce(double* vector_sum, long long vector_size, double threshold, int my_rank, int p_size, int* switched);
+long long merge_runs(double* run, long long run_pairs, const double* other, long long other_pairs);
+long long codec_tree_reduce(double* vector_sum, long long vector_size, int codec, int my_rank, int p_size);
+void repro_tree_reduce(double* acc, long long vector_size, int my_rank, int p_size);
+void persistent_tree_reduce(double* vector_sum, long long vector_size, long long iterations, double* latencies, int my_rank, int p_size);
+
+// values of the -a option
+#define NO_ALLREDUCE 0
+#define RD_ALLREDUCE 1
+#define RING_ALLREDUCE 2
+#define MPI_ALLREDUCE 3
+#define SWEEP_ALLREDUCE 4
+
+// -f multiplies every element by this, so that the sums are not integers and
+// their rounding depends on the order of the additions
+#define FRACTION_SCALE 0.1
 
 int main(int argc, char** argv)
 {
     // setting up MPI and broadcasting parameters
-    int vector_count, vector_size;
+    long long vector_count, vector_size;
+    long long segment_size = 0; // 0 means send the whole vector at once
+    int allreduce = NO_ALLREDUCE;
+    int node_aware = 0;
+    char output_file[4096] = ""; // empty means no -o
+    long long stride = 1; // vector i only has elements j with j%stride == i%stride
+    double threshold = 0; // 0 means no sparse reduction
+    int codec = NO_CODEC;
+    int reproducible = 0;
+    int fraction = 0;
+    long long iterations = 0; // 0 means one reduction without persistent requests
     int p_size, my_rank;
-    int start_i, end_i;
+    long long start_i, end_i;
     double begin;
     MPI_Init(NULL, NULL);
     MPI_Comm_size(MPI_COMM_WORLD, &p_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
     if(0 == my_rank)
     {
-        if(3 != argc)
+        struct option long_options[] =
+        {
+            {"segment", required_argument, NULL, 's'},
+            {"allreduce", required_argument, NULL, 'a'},
+            {"node-aware", no_argument, NULL, 'n'},
+            {"output", required_argument, NULL, 'o'},
+            {"stride", required_argument, NULL, 'z'},
+            {"sparse", required_argument, NULL, 'p'},
+            {"codec", required_argument, NULL, 'c'},
+            {"reproducible", no_argument, NULL, 'r'},
+            {"fraction", no_argument, NULL, 'f'},
+            {"iterations", required_argument, NULL, 'i'},
+            {0, 0, 0, 0}
+        };
+        int optchar;
+        while(-1 != (optchar = getopt_long(argc, argv, "s:a:no:z:p:c:rfi:", long_options, NULL)))
+        {
+            switch(optchar)
+            {
+                case 's':
+                    segment_size = strtoll(optarg, NULL, 10);
+                    break;
+                case 'a':
+                    if(0 == strcmp(optarg, "rd")) allreduce = RD_ALLREDUCE;
+                    else if(0 == strcmp(optarg, "ring")) allreduce = RING_ALLREDUCE;
+                    else if(0 == strcmp(optarg, "mpi")) allreduce = MPI_ALLREDUCE;
+                    else if(0 == strcmp(optarg, "sweep")) allreduce = SWEEP_ALLREDUCE;
+                    else
+                    {
+                        printf("Unknown allreduce algorithm: %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
+                case 'n':
+                    node_aware = 1;
+                    break;
+                case 'o':
+                    snprintf(output_file, sizeof(output_file), "%s", optarg);
+                    break;
+                case 'z':
+                    stride = strtoll(optarg, NULL, 10);
+                    break;
+                case 'p':
+                    threshold = strtod(optarg, NULL);
+                    break;
+                case 'c':
+                    codec = codec_from_name(optarg);
+                    if(-1 == codec)
+                    {
+                        printf("Unknown codec: %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
+                case 'r':
+                    reproducible = 1;
+                    break;
+                case 'f':
+                    fraction = 1;
+                    break;
+                case 'i':
+                    iterations = strtoll(optarg, NULL, 10);
+                    break;
+                default:
+                    printf("Unknown option\n");
+                    exit(1);
+            }
+        }
+        if(2 != argc-optind || segment_size < 0 || stride < 1 || threshold < 0 || threshold > 1 || iterations < 0)
         {
             printf("Wrong number of arguments\n");
             exit(1);
         }
-        vector_count = strtol(argv[1], NULL, 10);
-        vector_size = strtol(argv[2], NULL, 10);
+        if(0 != output_file[0] && NO_ALLREDUCE != allreduce)
+        {
+            printf("-o can not be combined with -a\n");
+            exit(1);
+        }
+        if(node_aware && (NO_ALLREDUCE != allreduce || 0 != output_file[0]))
+        {
+            printf("-n can not be combined with -a or -o\n");
+            exit(1);
+        }
+        if(0 < threshold && (0 < segment_size || NO_ALLREDUCE != allreduce || node_aware || 0 != output_file[0]))
+        {
+            printf("-p can not be combined with -s, -a, -n or -o\n");
+            exit(1);
+        }
+        if(NO_CODEC != codec && (0 < segment_size || NO_ALLREDUCE != allreduce || node_aware || 0 != output_file[0] || 0 < threshold))
+        {
+            printf("-c can not be combined with -s, -a, -n, -o or -p\n");
+            exit(1);
+        }
+        // -r, -f and -i only change the plain tree (and -r its local sums),
+        // every other mode would ignore them
+        int other_mode = 0 < segment_size || NO_ALLREDUCE != allreduce || node_aware || 0 != output_file[0] || 0 < threshold || NO_CODEC != codec;
+        if(reproducible && (other_mode || 0 < iterations))
+        {
+            printf("-r can not be combined with -s, -a, -n, -o, -p, -c or -i\n");
+            exit(1);
+        }
+        if(fraction && other_mode)
+        {
+            printf("-f can not be combined with -s, -a, -n, -o, -p or -c\n");
+            exit(1);
+        }
+        if(0 < iterations && other_mode)
+        {
+            printf("-i can not be combined with -s, -a, -n, -o, -p or -c\n");
+            exit(1);
+        }
+#ifdef THREAD_MPI
+        if(node_aware || 0 != output_file[0])
+        {
+            printf("-n and -o need MPI windows and MPI-IO, which the threads build does not have\n");
+            exit(1);
+        }
+#endif
+        vector_count = strtoll(argv[optind], NULL, 10);
+        vector_size = strtoll(argv[optind+1], NULL, 10);
     }
-    MPI_Bcast(&vector_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&vector_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&vector_count, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&vector_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&segment_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&allreduce, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&node_aware, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(output_file, sizeof(output_file), MPI_CHAR, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&stride, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&threshold, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&codec, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&reproducible, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&fraction, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&iterations, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    int write_output = 0 != output_file[0];
     // distributing vectors to add
     if(my_rank < vector_count%p_size)
     {
-        int temp = vector_count/p_size;
+        long long temp = vector_count/p_size;
         start_i = my_rank * temp + my_rank;
         end_i = start_i + temp + 1;
     }
     else
     {
-        int temp = vector_count/p_size;
+        long long temp = vector_count/p_size;
         start_i = my_rank * temp + vector_count%p_size;
         end_i = start_i + temp;
     }
+    if(MAX_MESSAGE < segment_size)
+    {
+        segment_size = MAX_MESSAGE;
+    }
+    if(SWEEP_ALLREDUCE == allreduce)
+    {
+        allreduce_sweep(vector_count, vector_size, start_i, end_i, my_rank, p_size);
+        MPI_Finalize();
+        return 0;
+    }
     
+    // With -n the cores of a node add their vectors straight into one shared
+    // window and only the node leaders (node rank 0) take part in the tree.
+    // The communicators and the window are set up once, outside the timing.
+    double* vector_sum;
+    MPI_Comm node_comm = MPI_COMM_NULL, leader_comm = MPI_COMM_NULL;
+    MPI_Win node_window = MPI_WIN_NULL;
+    int node_rank = 0, leader_rank, leader_size = 0;
+    int sparse = 0 < threshold;
+    double* latencies = NULL;
+    double scale = fraction ? FRACTION_SCALE : 1;
+    // -r: the levels of the accumulators come from the largest element any
+    // core adds, vector end_i-1 at position vector_size-1
+    double* acc = NULL;
+    if(reproducible)
+    {
+        double max_abs = start_i<end_i ? ((double)(end_i-1)*(double)vector_size + (double)(vector_size-1))*scale : 0;
+        MPI_Allreduce(MPI_IN_PLACE, &max_abs, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        repro_setup(max_abs, vector_count);
+    }
+    if(node_aware)
+    {
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_split(MPI_COMM_WORLD, 0==node_rank ? 0 : MPI_UNDEFINED, my_rank, &leader_comm);
+        if(MPI_COMM_NULL != leader_comm)
+        {
+            MPI_Comm_rank(leader_comm, &leader_rank);
+            MPI_Comm_size(leader_comm, &leader_size);
+        }
+        MPI_Win_allocate_shared(vector_size*sizeof(double), sizeof(double), MPI_INFO_NULL, node_comm, &vector_sum, &node_window);
+    }
+
     MPI_Barrier(MPI_COMM_WORLD);
     begin = elapsed_seconds();
     // adding vectors
-    double* vector_sum;
-    vector_sum = (double*) malloc(vector_size*sizeof(double));
+    if(!node_aware)
+    {
+        vector_sum = (double*) malloc(vector_size*sizeof(double));
+    }
+    if(reproducible)
+    {
+        acc = (double*) malloc(vector_size*REPRO_FOLDS*sizeof(double));
+        repro_add_vectors(acc, start_i, end_i, vector_size, stride, scale);
+    }
+    else
+    {
+        add_vectors(vector_sum, start_i, end_i, vector_size, stride, scale);
+    }
+    // sending results to core 0, or to every core for the allreduce modes
+    double reduce_begin = elapsed_seconds();
+    double cpu_begin = cpu_seconds();
+    // with -o every core ends up with one summed block and writes it to the
+    // file itself, so the whole vector never has to pass through core 0
+    long long* counts = NULL;
+    long long* displs = NULL;
+    int my_block = (my_rank+1)%p_size; // the block ring_reduce_scatter leaves here
+    long long bytes_sent = 0;
+    int switched = 0;
+    if(write_output)
+    {
+        counts = (long long*) malloc(p_size*sizeof(long long));
+        displs = (long long*) malloc(p_size*sizeof(long long));
+        ring_blocks(vector_size, p_size, counts, displs);
+        double* temp_sum = (double*) malloc((counts[0]<MAX_MESSAGE ? counts[0] : MAX_MESSAGE)*sizeof(double));
+        ring_reduce_scatter(vector_sum, counts, displs, temp_sum, my_rank, p_size);
+        free(temp_sum);
+    }
+    else if(RD_ALLREDUCE == allreduce)
+    {
+        recursive_doubling_allreduce(vector_sum, vector_size, my_rank, p_size);
+    }
+    else if(RING_ALLREDUCE == allreduce)
+    {
+        ring_allreduce(vector_sum, vector_size, my_rank, p_size);
+    }
+    else if(MPI_ALLREDUCE == allreduce)
+    {
+        mpi_allreduce(vector_sum, vector_size);
+    }
+    else if(node_aware)
+    {
+        node_reduce(vector_size, node_comm, node_window);
+        if(MPI_COMM_NULL != leader_comm)
+        {
+            if(0 < segment_size && segment_size < vector_size)
+            {
+                pipelined_tree_reduce(vector_sum, vector_size, segment_size, leader_rank, leader_size, leader_comm);
+            }
+            else
+            {
+                tree_reduce(vector_sum, vector_size, leader_rank, leader_size, leader_comm);
+            }
+        }
+    }
+    else if(sparse)
+    {
+        bytes_sent = sparse_tree_reduce(vector_sum, vector_size, threshold, my_rank, p_size, &switched);
+    }
+    else if(NO_CODEC != codec)
+    {
+        bytes_sent = codec_tree_reduce(vector_sum, vector_size, codec, my_rank, p_size);
+    }
+    else if(reproducible)
+    {
+        repro_tree_reduce(acc, vector_size, my_rank, p_size);
+        if(0 == my_rank)
+        {
+            repro_finish(acc, vector_sum, vector_size);
+        }
+        free(acc);
+    }
+    else if(0 < iterations)
+    {
+        latencies = (double*) malloc(iterations*sizeof(double));
+        persistent_tree_reduce(vector_sum, vector_size, iterations, latencies, my_rank, p_size);
+    }
+    else if(0 < segment_size && segment_size < vector_size)
+    {
+        pipelined_tree_reduce(vector_sum, vector_size, segment_size, my_rank, p_size, MPI_COMM_WORLD);
+    }
+    else
+    {
+        tree_reduce(vector_sum, vector_size, my_rank, p_size, MPI_COMM_WORLD);
+    }
+    double reduce_end = elapsed_seconds();
+    double cpu_time = cpu_seconds()-cpu_begin;
+    if(sparse || NO_CODEC != codec)
+    {
+        MPI_Reduce(0==my_rank ? MPI_IN_PLACE : &bytes_sent, &bytes_sent, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(0==my_rank ? MPI_IN_PLACE : &switched, &switched, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+    if(0 < iterations)
+    {
+        // an iteration takes as long as its slowest core
+        MPI_Reduce(0==my_rank ? MPI_IN_PLACE : latencies, latencies, iterations, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+    if(write_output)
+    {
+        write_slice(output_file, vector_sum+displs[my_block], displs[my_block], counts[my_block], counts[0],
+            vector_count, vector_size, stride, my_rank, p_size);
+    }
+    // testing and printing out results
+    if(write_output)
+    {
+        MPI_Barrier(MPI_COMM_WORLD); // every slice is in the file
+        if(0 == my_rank)
+        {
+            double end = elapsed_seconds();
+            printf("Time taken: %f\n", end-begin);
+            printf("Reduction time: %f (core 0 CPU time: %f)\n", reduce_end-reduce_begin, cpu_time);
+            printf("Write time: %f (%f MB/s)\n", end-reduce_end, (double)vector_size*sizeof(double)/(end-reduce_end)/1e6);
+            printf("Wrote %lld doubles in %d slices to %s\n", vector_size, p_size, output_file);
+        }
+        test_slice(vector_sum+displs[my_block], displs[my_block], counts[my_block], vector_count, vector_size, stride);
+        free(displs);
+        free(counts);
+    }
+    else if(0 == my_rank)
+    {
+        double end = reduce_end;
+        if(NO_ALLREDUCE == allreduce && 0 < segment_size && segment_size < vector_size)
+        {
+            printf("Segment size: %lld (%lld segments)\n", segment_size, (vector_size+segment_size-1)/segment_size);
+        }
+        if(sparse)
+        {
+            long long dense_bytes = (long long)(p_size-1)*vector_size*sizeof(double);
+            printf("Sparse threshold: %f, stride: %lld, cores that went dense: %d\n", threshold, stride, switched);
+            printf("Bytes sent: %lld (%.1f%% of the dense tree)\n", bytes_sent, 0<dense_bytes ? 100.0*bytes_sent/dense_bytes : 0.0);
+        }
+        if(NO_CODEC != codec)
+        {
+            double dense_bytes = (double)(p_size-1)*vector_size*sizeof(double);
+            printf("Codec: %s\n", codec_name(codec));
+            printf("Bytes sent: %lld (%.1f%% of the dense tree)\n", bytes_sent, 0<dense_bytes ? 100.0*bytes_sent/dense_bytes : 0.0);
+            printf("Effective bandwidth: %f MB/s of dense doubles\n", dense_bytes/(end-reduce_begin)/1e6);
+        }
+        if(reproducible)
+        {
+            printf("Reproducible sum: %d levels of accumulators\n", REPRO_FOLDS);
+        }
+        if(node_aware)
+        {
+            int node_size;
+            MPI_Comm_size(node_comm, &node_size);
+            printf("Nodes: %d (%d cores on the node of core 0)\n", leader_size, node_size);
+        }
+        printf("Time taken: %f\n", end-begin);
+        printf("Reduction time: %f (core 0 CPU time: %f)\n", end-reduce_begin, cpu_time);
+        if(0 < iterations)
+        {
+            print_latencies(latencies, iterations, NULL);
+        }
+        if(reproducible || 1 != scale)
+        {
+            // the bits to compare between runs with different numbers of cores
+            printf("Result hash: %016llx\n", (unsigned long long)repro_hash(vector_sum, vector_size));
+        }
+        if(F32_CODEC == codec || BF16_CODEC == codec || 1 != scale)
+        {
+            print_error(vector_sum, vector_count, vector_size, stride, scale); // no exact test
+        }
+        else
+        {
+            test_result(vector_sum, vector_count, vector_size, stride, 1); // test result
+        }
+    }
+    else if(NO_ALLREDUCE != allreduce)
+    {
+        test_result(vector_sum, vector_count, vector_size, stride, 0); // every core holds the sum
+    }
+
+    if(node_aware)
+    {
+        MPI_Win_free(&node_window);
+        if(MPI_COMM_NULL != leader_comm)
+        {
+            MPI_Comm_free(&leader_comm);
+        }
+        MPI_Comm_free(&node_comm);
+    }
+    else
+    {
+        free(vector_sum);
+    }
+    free(latencies);
+    MPI_Finalize();
+    return 0;
+}
+
+// vector i has the elements (i*vector_size + j)*scale, with -z only at the
+// positions j that equal i modulo stride and zero elsewhere
+void add_vectors(double* vector_sum, long long start_i, long long end_i, long long vector_size, long long stride, double scale)
+{
     memset(vector_sum, 0, vector_size*sizeof(double));
-    for(int i=start_i; i<end_i; i++)
+    for(long long i=start_i; i<end_i; i++)
     {
-        for(int j=0; j<vector_size; j++)
+        for(long long j=i%stride; j<vector_size; j+=stride)
         {
-            vector_sum[j] += (double)i*(double)vector_size + (double)j;
+            vector_sum[j] += ((double)i*(double)vector_size + (double)j)*scale;
         }
     }
-    // sending results to core 0
+}
+
+// MPI_Sendrecv of vectors of any length, in pieces of at most MAX_MESSAGE
+// doubles. dest or source may be MPI_PROC_NULL to only send or only receive.
+// With temp_sum (room for one piece) every received piece is added into recv
+// instead of stored there, so no vector sized receive buffer is needed.
+void sendrecv_vector(double* send, long long send_size, int dest, double* recv, long long recv_size, int source, double* temp_sum, MPI_Comm comm)
+{
+    long long total = send_size>recv_size ? send_size : recv_size;
+    for(long long offset=0; offset<total; offset+=MAX_MESSAGE)
+    {
+        // both sides of a transfer agree on its pieces, so a core whose
+        // other direction is longer just skips the missing ones
+        int send_len = offset<send_size ? (int)(send_size-offset<MAX_MESSAGE ? send_size-offset : MAX_MESSAGE) : 0;
+        int recv_len = offset<recv_size ? (int)(recv_size-offset<MAX_MESSAGE ? recv_size-offset : MAX_MESSAGE) : 0;
+        double* target = recv+offset;
+        MPI_Sendrecv(send+offset, send_len, MPI_DOUBLE, 0<send_len ? dest : MPI_PROC_NULL, 0,
+            NULL==temp_sum ? target : temp_sum, recv_len, MPI_DOUBLE, 0<recv_len ? source : MPI_PROC_NULL, 0, comm, MPI_STATUS_IGNORE);
+        if(NULL != temp_sum)
+        {
+            for(int j=0; j<recv_len; j++)
+            {
+                target[j] += temp_sum[j];
+            }
+        }
+    }
+}
+
+// in place MPI_Allreduce, one piece at a time
+void mpi_allreduce(double* vector_sum, long long vector_size)
+{
+    for(long long offset=0; offset<vector_size; offset+=MAX_MESSAGE)
+    {
+        int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+        MPI_Allreduce(MPI_IN_PLACE, vector_sum+offset, len, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+}
+
+// binomial tree: at round i, ranks that are multiples of 2^(i+1) receive the
+// whole vector from rank+2^i and add it into their own partial sum
+void tree_reduce(double* vector_sum, long long vector_size, int my_rank, int p_size, MPI_Comm comm)
+{
     int iterCount = ceil(log(p_size)/log(2));
     int div = 2;
     int pair = 1;
+    double* temp_sum;
+    temp_sum = (double*) malloc((vector_size<MAX_MESSAGE ? vector_size : MAX_MESSAGE)*sizeof(double));
     for(int i=0; i<iterCount; i++)
     {
         if(0 == my_rank%div && my_rank+pair<p_size)
         {
-            double* temp_sum;
-            temp_sum = (double*) malloc(vector_size*sizeof(double));
-            MPI_Recv(temp_sum, vector_size, MPI_DOUBLE, my_rank+pair, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            for(int i=0; i<vector_size; i++)
+            sendrecv_vector(NULL, 0, MPI_PROC_NULL, vector_sum, vector_size, my_rank+pair, temp_sum, comm);
+        }
+        else if(pair == my_rank%div)
+        {
+            sendrecv_vector(vector_sum, vector_size, my_rank-pair, NULL, 0, MPI_PROC_NULL, NULL, comm);
+        }
+        div *= 2;
+        pair *= 2;
+    }
+    free(temp_sum);
+}
+
+// same tree as tree_reduce, but the vector travels in segments of segment_size
+// doubles. Receives go into a double buffer so that adding segment k overlaps
+// with receiving segment k+1, and a finished segment is forwarded to the parent
+// right away instead of waiting for the whole vector. With enough segments the
+// cost approaches log(p)*alpha + n*beta instead of log(p)*(alpha + n*beta).
+void pipelined_tree_reduce(double* vector_sum, long long vector_size, long long segment_size, int my_rank, int p_size, MPI_Comm comm)
+{
+    int children[32];
+    int child_count = 0;
+    for(int pair=1; pair<p_size && 0 == my_rank%(2*pair); pair*=2)
+    {
+        if(my_rank+pair < p_size)
+        {
+            children[child_count++] = my_rank+pair;
+        }
+    }
+    int parent = my_rank - (my_rank & -my_rank); // clear the lowest set bit
+
+    long long segment_count = (vector_size+segment_size-1)/segment_size;
+    double* buffers[2];
+    buffers[0] = (double*) malloc(2*segment_size*sizeof(double));
+    buffers[1] = buffers[0] + segment_size;
+    MPI_Request recv_reqs[2];
+    MPI_Request* send_reqs = (MPI_Request*) malloc(segment_count*sizeof(MPI_Request));
+
+    // receive k is segment k/child_count from child k%child_count
+    long long recv_total = segment_count*child_count;
+    if(0 < recv_total)
+    {
+        int len = segment_count>1 ? segment_size : vector_size;
+        MPI_Irecv(buffers[0], len, MPI_DOUBLE, children[0], 0, comm, &recv_reqs[0]);
+    }
+    for(long long s=0; s<segment_count; s++)
+    {
+        long long offset = s*segment_size;
+        int len = offset+segment_size<vector_size ? segment_size : vector_size-offset;
+        for(int c=0; c<child_count; c++)
+        {
+            long long k = s*child_count + c;
+            if(k+1 < recv_total)
+            {
+                long long next_s = (k+1)/child_count;
+                long long next_offset = next_s*segment_size;
+                int next_len = next_offset+segment_size<vector_size ? segment_size : vector_size-next_offset;
+                MPI_Irecv(buffers[(k+1)%2], next_len, MPI_DOUBLE, children[(k+1)%child_count], 0, comm, &recv_reqs[(k+1)%2]);
+            }
+            MPI_Wait(&recv_reqs[k%2], MPI_STATUS_IGNORE);
+            double* temp_sum = buffers[k%2];
+            for(int j=0; j<len; j++)
+            {
+                vector_sum[offset+j] += temp_sum[j];
+            }
+        }
+        if(0 != my_rank)
+        {
+            MPI_Isend(vector_sum+offset, len, MPI_DOUBLE, parent, 0, comm, &send_reqs[s]);
+        }
+    }
+    if(0 != my_rank)
+    {
+        MPI_Waitall(segment_count, send_reqs, MPI_STATUSES_IGNORE);
+    }
+    free(send_reqs);
+    free(buffers[0]);
+}
+
+// first level of the -n reduction: every core has added its vectors into its
+// own segment of the node's shared window. Every core of the node adds up one
+// slice of the vector over all segments of the node and stores it in the
+// leader's segment, so the node's partial sums meet in memory without any
+// message or copy.
+void node_reduce(long long vector_size, MPI_Comm node_comm, MPI_Win node_window)
+{
+    int node_rank, node_size;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    double** segments = (double**) malloc(node_size*sizeof(double*));
+    for(int r=0; r<node_size; r++)
+    {
+        MPI_Aint segment_bytes;
+        int disp_unit;
+        MPI_Win_shared_query(node_window, r, &segment_bytes, &disp_unit, &segments[r]);
+    }
+    long long start_j = vector_size*node_rank/node_size;
+    long long end_j = vector_size*(node_rank+1)/node_size;
+
+    // the barriers order the stores of the other cores before the loads
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, node_window);
+    MPI_Win_sync(node_window);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(node_window);
+    double* leader_sum = segments[0];
+    for(int r=1; r<node_size; r++)
+    {
+        double* partial_sum = segments[r];
+        for(long long j=start_j; j<end_j; j++)
+        {
+            leader_sum[j] += partial_sum[j];
+        }
+    }
+    MPI_Win_sync(node_window);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(node_window);
+    MPI_Win_unlock_all(node_window);
+    free(segments);
+}
+
+// -p mode: the tree of tree_reduce, but a partial sum with at most
+// threshold*vector_size nonzeros travels as a sorted run of (index, value)
+// pairs instead of the dense vector. Both halves of a pair are doubles (the
+// indices are exact below 2^53), so runs go through sendrecv_vector like
+// vectors do. Every message is preceded by the number of pairs, or -1 for a
+// dense vector. Received runs are merged into the own run, and once the two
+// runs no longer fit below the threshold the core scatters them into its
+// dense vector and stays dense for the rest of the tree. Memory is the dense
+// vector plus two runs, 1+4*threshold vectors. Returns the bytes sent.
+long long sparse_tree_reduce(double* vector_sum, long long vector_size, double threshold, int my_rank, int p_size, int* switched)
+{
+    long long capacity = (long long)(threshold*vector_size); // pairs per run
+    double* run = (double*) malloc((2*capacity+1)*sizeof(double));
+    double* other = (double*) malloc((2*capacity+1)*sizeof(double));
+    double* temp_sum = NULL;
+    long long bytes_sent = 0;
+
+    // the own partial sum as a run, or -1 if it is too full
+    long long pairs = 0;
+    for(long long j=0; j<vector_size && -1!=pairs; j++)
+    {
+        if(0 != vector_sum[j])
+        {
+            if(pairs == capacity)
             {
-                vector_sum[i] += temp_sum[i];
+                pairs = -1;
+                break;
+            }
+            run[2*pairs] = (double)j;
+            run[2*pairs+1] = vector_sum[j];
+            pairs++;
+        }
+    }
+    *switched = -1 == pairs;
+
+    int iterCount = ceil(log(p_size)/log(2));
+    int div = 2;
+    int pair = 1;
+    for(int i=0; i<iterCount; i++)
+    {
+        if(0 == my_rank%div && my_rank+pair<p_size)
+        {
+            long long other_pairs;
+            MPI_Recv(&other_pairs, 1, MPI_LONG_LONG, my_rank+pair, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            if(-1 != other_pairs)
+            {
+                sendrecv_vector(NULL, 0, MPI_PROC_NULL, other, 2*other_pairs, my_rank+pair, NULL, MPI_COMM_WORLD);
+            }
+            if(-1 != pairs && -1 != other_pairs && pairs+other_pairs <= capacity)
+            {
+                pairs = merge_runs(run, pairs, other, other_pairs);
+            }
+            else
+            {
+                // switching to dense: the run holds the merged children too
+                if(-1 != pairs)
+                {
+                    memset(vector_sum, 0, vector_size*sizeof(double));
+                    for(long long k=0; k<pairs; k++)
+                    {
+                        vector_sum[(long long)run[2*k]] = run[2*k+1];
+                    }
+                    pairs = -1;
+                    *switched = 1;
+                }
+                if(-1 != other_pairs)
+                {
+                    for(long long k=0; k<other_pairs; k++)
+                    {
+                        vector_sum[(long long)other[2*k]] += other[2*k+1];
+                    }
+                }
+                else
+                {
+                    if(NULL == temp_sum)
+                    {
+                        temp_sum = (double*) malloc((vector_size<MAX_MESSAGE ? vector_size : MAX_MESSAGE)*sizeof(double));
+                    }
+                    sendrecv_vector(NULL, 0, MPI_PROC_NULL, vector_sum, vector_size, my_rank+pair, temp_sum, MPI_COMM_WORLD);
+                }
             }
-            free(temp_sum);
         }
         else if(pair == my_rank%div)
         {
-            MPI_Send(vector_sum, vector_size, MPI_DOUBLE, my_rank-pair, 0, MPI_COMM_WORLD);
+            MPI_Send(&pairs, 1, MPI_LONG_LONG, my_rank-pair, 0, MPI_COMM_WORLD);
+            bytes_sent += sizeof(long long);
+            if(-1 != pairs)
+            {
+                sendrecv_vector(run, 2*pairs, my_rank-pair, NULL, 0, MPI_PROC_NULL, NULL, MPI_COMM_WORLD);
+                bytes_sent += 2*pairs*sizeof(double);
+            }
+            else
+            {
+                sendrecv_vector(vector_sum, vector_size, my_rank-pair, NULL, 0, MPI_PROC_NULL, NULL, MPI_COMM_WORLD);
+                bytes_sent += vector_size*sizeof(double);
+            }
         }
         div *= 2;
         pair *= 2;
     }
-    // testing and printing out results
+    // core 0 turns a final run back into the dense result
+    if(0 == my_rank && -1 != pairs)
+    {
+        memset(vector_sum, 0, vector_size*sizeof(double));
+        for(long long k=0; k<pairs; k++)
+        {
+            vector_sum[(long long)run[2*k]] = run[2*k+1];
+        }
+    }
+    free(temp_sum);
+    free(other);
+    free(run);
+    return bytes_sent;
+}
+
+// Merges the sorted run other into the sorted run run, adding the values of
+// equal indices, and returns the number of pairs of the result. run has room
+// for run_pairs+other_pairs pairs. The merge goes from the back, so it
+// never overwrites a pair of run that is still to be read.
+long long merge_runs(double* run, long long run_pairs, const double* other, long long other_pairs)
+{
+    long long a = run_pairs-1, b = other_pairs-1, w = run_pairs+other_pairs-1;
+    while(0 <= b)
+    {
+        if(0 <= a && run[2*a] > other[2*b])
+        {
+            run[2*w] = run[2*a];
+            run[2*w+1] = run[2*a+1];
+            a--;
+        }
+        else if(0 <= a && run[2*a] == other[2*b])
+        {
+            run[2*w] = run[2*a];
+            run[2*w+1] = run[2*a+1] + other[2*b+1];
+            a--;
+            b--;
+        }
+        else
+        {
+            run[2*w] = other[2*b];
+            run[2*w+1] = other[2*b+1];
+            b--;
+        }
+        w--;
+    }
+    // pairs 0 ... a are still in place, equal indices left a gap before the
+    // merged tail w+1 ... run_pairs+other_pairs-1
+    long long tail = run_pairs+other_pairs-1-w;
+    memmove(run+2*(a+1), run+2*(w+1), 2*tail*sizeof(double));
+    return a+1+tail;
+}
+
+// -c mode: the tree of tree_reduce, but every core sends its partial sum
+// encoded with codec (see vector_codec.h), one message per piece of
+// CODEC_PIECE doubles. The receiver learns the size of a piece with
+// MPI_Probe, decodes it and adds it in double. Returns the bytes sent.
+long long codec_tree_reduce(double* vector_sum, long long vector_size, int codec, int my_rank, int p_size)
+{
+    long long piece = vector_size<CODEC_PIECE ? vector_size : CODEC_PIECE;
+    unsigned char* message = (unsigned char*) malloc(codec_max_bytes(piece));
+    uint64_t* scratch = (uint64_t*) malloc(piece*sizeof(uint64_t));
+    long long bytes_sent = 0;
+    int iterCount = ceil(log(p_size)/log(2));
+    int div = 2;
+    int pair = 1;
+    for(int i=0; i<iterCount; i++)
+    {
+        for(long long offset=0; offset<vector_size; offset+=CODEC_PIECE)
+        {
+            long long len = vector_size-offset<CODEC_PIECE ? vector_size-offset : CODEC_PIECE;
+            if(0 == my_rank%div && my_rank+pair<p_size)
+            {
+                MPI_Status status;
+                int bytes;
+                MPI_Probe(my_rank+pair, 0, MPI_COMM_WORLD, &status);
+                MPI_Get_count(&status, MPI_BYTE, &bytes);
+                MPI_Recv(message, bytes, MPI_BYTE, my_rank+pair, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                codec_decode_add(codec, message, vector_sum+offset, len, scratch);
+            }
+            else if(pair == my_rank%div)
+            {
+                int bytes = (int)codec_encode(codec, vector_sum+offset, len, message);
+                MPI_Send(message, bytes, MPI_BYTE, my_rank-pair, 0, MPI_COMM_WORLD);
+                bytes_sent += bytes;
+            }
+        }
+        div *= 2;
+        pair *= 2;
+    }
+    free(scratch);
+    free(message);
+    return bytes_sent;
+}
+
+// -r mode: the tree of tree_reduce on the accumulators of repro_sum.h. An
+// element is REPRO_FOLDS doubles and received elements are merged with
+// repro_merge, which is exact, so the result does not depend on the tree.
+void repro_tree_reduce(double* acc, long long vector_size, int my_rank, int p_size)
+{
+    long long piece = MAX_MESSAGE/REPRO_FOLDS; // elements per message
+    double* temp = (double*) malloc((vector_size<piece ? vector_size : piece)*REPRO_FOLDS*sizeof(double));
+    int iterCount = ceil(log(p_size)/log(2));
+    int div = 2;
+    int pair = 1;
+    for(int i=0; i<iterCount; i++)
+    {
+        for(long long offset=0; offset<vector_size; offset+=piece)
+        {
+            long long len = vector_size-offset<piece ? vector_size-offset : piece;
+            if(0 == my_rank%div && my_rank+pair<p_size)
+            {
+                MPI_Recv(temp, len*REPRO_FOLDS, MPI_DOUBLE, my_rank+pair, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                repro_merge(temp, acc+offset*REPRO_FOLDS, len);
+            }
+            else if(pair == my_rank%div)
+            {
+                MPI_Send(acc+offset*REPRO_FOLDS, len*REPRO_FOLDS, MPI_DOUBLE, my_rank-pair, 0, MPI_COMM_WORLD);
+            }
+        }
+        div *= 2;
+        pair *= 2;
+    }
+    free(temp);
+}
+
+// --iterations: the tree of tree_reduce, repeated iterations times. The
+// pieces of every level are persistent requests set up once, the buffers are
+// allocated once, and every iteration starts again from this core's partial
+// sum, so the last one leaves the same result on core 0 as tree_reduce.
+// latencies[k] is how long iteration k took on this core, from a barrier.
+void persistent_tree_reduce(double* vector_sum, long long vector_size, long long iterations, double* latencies, int my_rank, int p_size)
+{
+    int iterCount = ceil(log(p_size)/log(2));
+    long long pieces = (vector_size+MAX_MESSAGE-1)/MAX_MESSAGE;
+    double* partial_sum = (double*) malloc(vector_size*sizeof(double));
+    double* temp_sum = (double*) malloc((vector_size<MAX_MESSAGE ? vector_size : MAX_MESSAGE)*sizeof(double));
+    MPI_Request* requests = (MPI_Request*) malloc((iterCount*pieces+1)*sizeof(MPI_Request));
+    memcpy(partial_sum, vector_sum, vector_size*sizeof(double));
+    // requests[i*pieces + k] is piece k of level i, MPI_REQUEST_NULL on the
+    // levels where this core neither receives nor sends
+    int div = 2;
+    int pair = 1;
+    for(int i=0; i<iterCount; i++)
+    {
+        for(long long k=0; k<pieces; k++)
+        {
+            long long offset = k*MAX_MESSAGE;
+            int len = (int)(vector_size-offset<MAX_MESSAGE ? vector_size-offset : MAX_MESSAGE);
+            MPI_Request* request = requests+i*pieces+k;
+            *request = MPI_REQUEST_NULL;
+            if(0 == my_rank%div && my_rank+pair<p_size)
+            {
+                MPI_Recv_init(temp_sum, len, MPI_DOUBLE, my_rank+pair, 0, MPI_COMM_WORLD, request);
+            }
+            else if(pair == my_rank%div)
+            {
+                MPI_Send_init(vector_sum+offset, len, MPI_DOUBLE, my_rank-pair, 0, MPI_COMM_WORLD, request);
+            }
+        }
+        div *= 2;
+        pair *= 2;
+    }
+
+    for(long long it=0; it<iterations; it++)
+    {
+        memcpy(vector_sum, partial_sum, vector_size*sizeof(double));
+        MPI_Barrier(MPI_COMM_WORLD);
+        double begin = MPI_Wtime(); // finer than gettimeofday for short iterations
+        div = 2;
+        pair = 1;
+        for(int i=0; i<iterCount; i++)
+        {
+            MPI_Request* level = requests+i*pieces;
+            if(0 == my_rank%div && my_rank+pair<p_size)
+            {
+                // one temp buffer, so the pieces are received one by one
+                for(long long k=0; k<pieces; k++)
+                {
+                    double* target = vector_sum+k*MAX_MESSAGE;
+                    int len = (int)(vector_size-k*MAX_MESSAGE<MAX_MESSAGE ? vector_size-k*MAX_MESSAGE : MAX_MESSAGE);
+                    MPI_Start(level+k);
+                    MPI_Wait(level+k, MPI_STATUS_IGNORE);
+                    for(int j=0; j<len; j++)
+                    {
+                        target[j] += temp_sum[j];
+                    }
+                }
+            }
+            else if(pair == my_rank%div)
+            {
+                MPI_Startall(pieces, level);
+                MPI_Waitall(pieces, level, MPI_STATUSES_IGNORE);
+            }
+            div *= 2;
+            pair *= 2;
+        }
+        latencies[it] = MPI_Wtime()-begin;
+    }
+
+    for(long long k=0; k<iterCount*pieces; k++)
+    {
+        if(MPI_REQUEST_NULL != requests[k])
+        {
+            MPI_Request_free(requests+k);
+        }
+    }
+    free(requests);
+    free(temp_sum);
+    free(partial_sum);
+}
+
+// latency optimal allreduce: log(p) rounds in which every core swaps its whole
+// vector with the core whose rank differs in one bit. When p is not a power of
+// two, the first 2*rem cores fold pairwise into rem cores before the exchange
+// and get the result back afterwards.
+void recursive_doubling_allreduce(double* vector_sum, long long vector_size, int my_rank, int p_size)
+{
+    int pof2 = 1;
+    while(2*pof2 <= p_size)
+    {
+        pof2 *= 2;
+    }
+    int rem = p_size - pof2;
+    double* temp_sum;
+    temp_sum = (double*) malloc((vector_size<MAX_MESSAGE ? vector_size : MAX_MESSAGE)*sizeof(double));
+
+    int new_rank;
+    if(my_rank < 2*rem)
+    {
+        if(0 == my_rank%2)
+        {
+            sendrecv_vector(vector_sum, vector_size, my_rank+1, NULL, 0, MPI_PROC_NULL, NULL, MPI_COMM_WORLD);
+            new_rank = -1;
+        }
+        else
+        {
+            sendrecv_vector(NULL, 0, MPI_PROC_NULL, vector_sum, vector_size, my_rank-1, temp_sum, MPI_COMM_WORLD);
+            new_rank = my_rank/2;
+        }
+    }
+    else
+    {
+        new_rank = my_rank - rem;
+    }
+
+    if(-1 != new_rank)
+    {
+        for(int mask=1; mask<pof2; mask*=2)
+        {
+            int new_pair = new_rank ^ mask;
+            int pair = new_pair<rem ? 2*new_pair+1 : new_pair+rem;
+            sendrecv_vector(vector_sum, vector_size, pair, vector_sum, vector_size, pair, temp_sum, MPI_COMM_WORLD);
+        }
+    }
+
+    if(my_rank < 2*rem)
+    {
+        if(0 == my_rank%2)
+        {
+            sendrecv_vector(NULL, 0, MPI_PROC_NULL, vector_sum, vector_size, my_rank+1, NULL, MPI_COMM_WORLD);
+        }
+        else
+        {
+            sendrecv_vector(vector_sum, vector_size, my_rank-1, NULL, 0, MPI_PROC_NULL, NULL, MPI_COMM_WORLD);
+        }
+    }
+    free(temp_sum);
+}
+
+// bandwidth optimal allreduce: the vector is cut into p blocks which travel
+// around a ring. In the reduce-scatter phase every core ends up owning one
+// fully summed block, in the allgather phase the blocks are passed around
+// until every core has all of them. Each core sends about 2*n*(p-1)/p doubles.
+void ring_allreduce(double* vector_sum, long long vector_size, int my_rank, int p_size)
+{
+    long long* counts = (long long*) malloc(p_size*sizeof(long long));
+    long long* displs = (long long*) malloc(p_size*sizeof(long long));
+    ring_blocks(vector_size, p_size, counts, displs);
+    int left = (my_rank-1+p_size)%p_size;
+    int right = (my_rank+1)%p_size;
+    double* temp_sum;
+    temp_sum = (double*) malloc((counts[0]<MAX_MESSAGE ? counts[0] : MAX_MESSAGE)*sizeof(double));
+
+    ring_reduce_scatter(vector_sum, counts, displs, temp_sum, my_rank, p_size);
+    for(int step=0; step<p_size-1; step++)
+    {
+        int send_block = (my_rank+1-step+p_size)%p_size;
+        int recv_block = (my_rank-step+p_size)%p_size;
+        sendrecv_vector(vector_sum+displs[send_block], counts[send_block], right,
+            vector_sum+displs[recv_block], counts[recv_block], left, NULL, MPI_COMM_WORLD);
+    }
+    free(temp_sum);
+    free(displs);
+    free(counts);
+}
+
+// cuts the vector into p blocks whose sizes differ by at most one, the
+// larger ones first
+void ring_blocks(long long vector_size, int p_size, long long* counts, long long* displs)
+{
+    for(int k=0; k<p_size; k++)
+    {
+        counts[k] = vector_size/p_size + (k < vector_size%p_size ? 1 : 0);
+        displs[k] = 0==k ? 0 : displs[k-1]+counts[k-1];
+    }
+}
+
+// first half of ring_allreduce: after p-1 steps core r holds the fully summed
+// block (r+1)%p, the other blocks of its vector are partial sums
+void ring_reduce_scatter(double* vector_sum, const long long* counts, const long long* displs, double* temp_sum, int my_rank, int p_size)
+{
+    int left = (my_rank-1+p_size)%p_size;
+    int right = (my_rank+1)%p_size;
+    for(int step=0; step<p_size-1; step++)
+    {
+        int send_block = (my_rank-step+p_size)%p_size;
+        int recv_block = (my_rank-step-1+p_size)%p_size;
+        sendrecv_vector(vector_sum+displs[send_block], counts[send_block], right,
+            vector_sum+displs[recv_block], counts[recv_block], left, temp_sum, MPI_COMM_WORLD);
+    }
+}
+
+// Writes elements first ... first+length-1 of the summed vector into one
+// shared file with collective MPI-IO, core 0 adds the header. The collective
+// calls go in pieces of at most MAX_MESSAGE doubles, and every core makes the
+// same number of calls (max_length is the longest slice), some of them empty.
+void write_slice(const char* output_file, double* slice, long long first, long long length, long long max_length,
+    long long vector_count, long long vector_size, long long stride, int my_rank, int p_size)
+{
+    MPI_File file;
+    if(MPI_SUCCESS != MPI_File_open(MPI_COMM_WORLD, output_file, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file))
+    {
+        if(0 == my_rank)
+        {
+            printf("Can not open %s\n", output_file);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    SumFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SUM_FILE_MAGIC, sizeof(header.magic));
+    header.header_size = sizeof(header);
+    header.vector_size = vector_size;
+    header.vector_count = vector_count;
+    header.element_size = sizeof(double);
+    header.writers = p_size;
+    header.stride = stride;
+    MPI_File_set_size(file, sizeof(header) + vector_size*sizeof(double)); // cuts an older, longer file
+    MPI_File_write_at_all(file, 0, &header, 0==my_rank ? sizeof(header) : 0, MPI_BYTE, MPI_STATUS_IGNORE);
+    for(long long offset=0; offset<max_length; offset+=MAX_MESSAGE)
+    {
+        int len = offset<length ? (int)(length-offset<MAX_MESSAGE ? length-offset : MAX_MESSAGE) : 0;
+        MPI_Offset position = sizeof(header) + (first+offset)*sizeof(double);
+        MPI_File_write_at_all(file, position, slice+offset, len, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&file);
+}
+
+// times every allreduce algorithm for vector sizes 1, 2, 4, ... up to max_size
+// and reports the smallest size from which ring beats recursive doubling
+void allreduce_sweep(long long vector_count, long long max_size, long long start_i, long long end_i, int my_rank, int p_size)
+{
+    const int repeat = 5;
+    const char* names[3] = {"recursive doubling", "ring", "MPI_Allreduce"};
+    long long crossover = -1;
+    double* vector_sum;
+    vector_sum = (double*) malloc(max_size*sizeof(double));
     if(0 == my_rank)
     {
-        double end = elapsed_seconds();
-        printf("Time taken: %f\n", end-begin);
-        test_result(vector_sum, vector_count, vector_size); // test result
+        printf("vector_size, %s, %s, %s\n", names[0], names[1], names[2]);
+    }
+    for(long long size=1; ; size = 2*size<max_size ? 2*size : max_size)
+    {
+        double best[3];
+        for(int algorithm=0; algorithm<3; algorithm++)
+        {
+            best[algorithm] = -1;
+            for(int r=0; r<repeat; r++)
+            {
+                add_vectors(vector_sum, start_i, end_i, size, 1, 1);
+                MPI_Barrier(MPI_COMM_WORLD);
+                double begin = elapsed_seconds();
+                if(0 == algorithm)
+                {
+                    recursive_doubling_allreduce(vector_sum, size, my_rank, p_size);
+                }
+                else if(1 == algorithm)
+                {
+                    ring_allreduce(vector_sum, size, my_rank, p_size);
+                }
+                else
+                {
+                    mpi_allreduce(vector_sum, size);
+                }
+                double time = elapsed_seconds()-begin;
+                MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+                test_result(vector_sum, vector_count, size, 1, 0);
+                if(best[algorithm] < 0 || time < best[algorithm])
+                {
+                    best[algorithm] = time;
+                }
+            }
+        }
+        if(best[1] < best[0])
+        {
+            if(-1 == crossover)
+            {
+                crossover = size;
+            }
+        }
+        else
+        {
+            crossover = -1;
+        }
+        if(0 == my_rank)
+        {
+            printf("%lld, %f, %f, %f\n", size, best[0], best[1], best[2]);
+        }
+        if(size == max_size)
+        {
+            break;
+        }
+    }
+    if(0 == my_rank)
+    {
+        if(-1 == crossover)
+        {
+            printf("Crossover: ring did not stay faster than recursive doubling up to vector_size %lld\n", max_size);
+        }
+        else
+        {
+            printf("Crossover: ring is faster than recursive doubling from vector_size %lld\n", crossover);
+        }
     }
-    
     free(vector_sum);
-    MPI_Finalize();
-    return 0;
 }
 
 double elapsed_seconds()
@@ -102,24 +1188,78 @@ double elapsed_seconds()
     return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
 }
 
-void test_result(double* vector_sum, int vector_count, int vector_size)
+// user plus system time of this core
+double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1000000.0;
+}
+
+void test_result(double* vector_sum, long long vector_count, long long vector_size, long long stride, int print_values)
 {
-    double res = (double)vector_size*(double)vector_count*(double)(vector_count-1)/(double)2;
-    for(int i=0; i<vector_size; i++)
+    test_slice(vector_sum, 0, vector_size, vector_count, vector_size, stride);
+    if(!print_values)
     {
-        double expected = res+(double)i*(double)vector_count;
-        if(vector_sum[i] != expected)
+        return;
+    }
+    int iterSize = vector_size<30 ? vector_size : 30;
+    for(int i=0; i<iterSize; i++)
+    {
+        printf("%.0f, ", vector_sum[i]);
+    }
+    printf("\n");
+}
+
+// checks elements first ... first+length-1 of the sum, stored in slice
+void test_slice(double* slice, long long first, long long length, long long vector_count, long long vector_size, long long stride)
+{
+    for(long long i=first; i<first+length; i++)
+    {
+        double expected = expected_value(i, vector_count, vector_size, stride);
+        if(slice[i-first] != expected)
         {
-            printf("Wrong value at %d\n", i);
+            printf("Wrong value at %lld\n", i);
             printf("Expected: %.0f\n", expected);
-            printf("Actual: %.0f\n", vector_sum[i]);
+            printf("Actual: %.0f\n", slice[i-first]);
             exit(1);
         }
     }
+}
+
+// Element i of the sum is the sum over the n vectors k = r, r+stride,
+// r+2*stride, ... below vector_count, r = i%stride, of k*vector_size + i.
+double expected_value(long long i, long long vector_count, long long vector_size, long long stride)
+{
+    long long r = i%stride;
+    long long n = r<vector_count ? (vector_count-1-r)/stride + 1 : 0;
+    return (double)vector_size*((double)n*(double)r + (double)stride*(double)n*(double)(n-1)/(double)2) + (double)i*(double)n;
+}
+
+// for the lossy codecs and -f: how far the result is from the exact sum
+void print_error(double* vector_sum, long long vector_count, long long vector_size, long long stride, double scale)
+{
+    double max_error = 0, max_relative = 0, squares = 0;
+    for(long long i=0; i<vector_size; i++)
+    {
+        double expected = expected_value(i, vector_count, vector_size, stride)*scale;
+        double error = fabs(vector_sum[i]-expected);
+        squares += error*error;
+        if(error > max_error)
+        {
+            max_error = error;
+        }
+        if(0 != expected && error/fabs(expected) > max_relative)
+        {
+            max_relative = error/fabs(expected);
+        }
+    }
+    printf("Max absolute error: %e, RMS error: %e, max relative error: %e\n",
+        max_error, sqrt(squares/(vector_size>0 ? vector_size : 1)), max_relative);
     int iterSize = vector_size<30 ? vector_size : 30;
     for(int i=0; i<iterSize; i++)
     {
         printf("%.0f, ", vector_sum[i]);
     }
     printf("\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,207 @@
+#include <string.h>
+#include "vector_codec.h"
+
+// first byte of an xor encoded piece
+#define XOR_RAW 0
+#define XOR_PLANES 1
+
+int codec_from_name(const char* name)
+{
+    if(0 == strcmp(name, "f32")) return F32_CODEC;
+    if(0 == strcmp(name, "bf16")) return BF16_CODEC;
+    if(0 == strcmp(name, "xor")) return XOR_CODEC;
+    return -1;
+}
+
+const char* codec_name(int codec)
+{
+    switch(codec)
+    {
+        case F32_CODEC: return "f32";
+        case BF16_CODEC: return "bf16";
+        case XOR_CODEC: return "xor";
+        default: return "none";
+    }
+}
+
+size_t codec_max_bytes(long long n)
+{
+    return 1 + n*sizeof(double);
+}
+
+static uint16_t float_to_bf16(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+static float bf16_to_float(uint16_t h)
+{
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// A plane is byte b of every xor delta. A zero byte starts a run: it is
+// followed by the length of the run in 7 bit groups, lowest first, with the
+// top bit set on all groups but the last. Other bytes are stored as they are.
+// Gives up and returns 0 once the output would not be smaller than raw.
+static size_t xor_encode(const double* in, long long n, unsigned char* out)
+{
+    size_t limit = n*sizeof(double);
+    size_t used = 1;
+    out[0] = XOR_PLANES;
+    for(int b=7; b>=0; b--)
+    {
+        uint64_t prev = 0;
+        long long zeros = 0;
+        for(long long i=0; i<=n; i++)
+        {
+            unsigned char byte = 0;
+            if(i < n)
+            {
+                uint64_t bits;
+                memcpy(&bits, in+i, sizeof(bits));
+                byte = (unsigned char)((bits ^ prev) >> (8*b));
+                prev = bits;
+                if(0 == byte)
+                {
+                    zeros++;
+                    continue;
+                }
+            }
+            if(0 < zeros)
+            {
+                if(used+11 > limit)
+                {
+                    return 0;
+                }
+                out[used++] = 0;
+                while(zeros >= 0x80)
+                {
+                    out[used++] = (unsigned char)(zeros | 0x80);
+                    zeros >>= 7;
+                }
+                out[used++] = (unsigned char)zeros;
+                zeros = 0;
+            }
+            if(i < n)
+            {
+                if(used+1 > limit)
+                {
+                    return 0;
+                }
+                out[used++] = byte;
+            }
+        }
+    }
+    return used;
+}
+
+static void xor_decode_add(const unsigned char* in, double* out, long long n, uint64_t* scratch)
+{
+    memset(scratch, 0, n*sizeof(uint64_t));
+    const unsigned char* p = in+1;
+    for(int b=7; b>=0; b--)
+    {
+        long long zeros = 0;
+        for(long long i=0; i<n; i++)
+        {
+            if(0 < zeros)
+            {
+                zeros--;
+                continue;
+            }
+            unsigned char byte = *p++;
+            if(0 == byte)
+            {
+                int shift = 0;
+                unsigned char group;
+                do
+                {
+                    group = *p++;
+                    zeros |= (long long)(group & 0x7f) << shift;
+                    shift += 7;
+                } while(group & 0x80);
+                zeros--; // this element is the first zero of the run
+                continue;
+            }
+            scratch[i] |= (uint64_t)byte << (8*b);
+        }
+    }
+    uint64_t bits = 0;
+    for(long long i=0; i<n; i++)
+    {
+        bits ^= scratch[i];
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        out[i] += value;
+    }
+}
+
+size_t codec_encode(int codec, const double* in, long long n, unsigned char* out)
+{
+    if(F32_CODEC == codec)
+    {
+        float* values = (float*) out;
+        for(long long i=0; i<n; i++)
+        {
+            values[i] = (float)in[i];
+        }
+        return n*sizeof(float);
+    }
+    if(BF16_CODEC == codec)
+    {
+        uint16_t* values = (uint16_t*) out;
+        for(long long i=0; i<n; i++)
+        {
+            values[i] = float_to_bf16((float)in[i]);
+        }
+        return n*sizeof(uint16_t);
+    }
+    size_t used = XOR_CODEC == codec ? xor_encode(in, n, out) : 0;
+    if(0 == used)
+    {
+        // incompressible (or no codec): one flag byte, then the raw doubles
+        out[0] = XOR_RAW;
+        memcpy(out+1, in, n*sizeof(double));
+        used = 1 + n*sizeof(double);
+    }
+    return used;
+}
+
+void codec_decode_add(int codec, const unsigned char* in, double* out, long long n, uint64_t* scratch)
+{
+    if(F32_CODEC == codec)
+    {
+        const float* values = (const float*) in;
+        for(long long i=0; i<n; i++)
+        {
+            out[i] += (double)values[i];
+        }
+    }
+    else if(BF16_CODEC == codec)
+    {
+        const uint16_t* values = (const uint16_t*) in;
+        for(long long i=0; i<n; i++)
+        {
+            out[i] += (double)bf16_to_float(values[i]);
+        }
+    }
+    else if(XOR_PLANES == in[0])
+    {
+        xor_decode_add(in, out, n, scratch);
+    }
+    else
+    {
+        for(long long i=0; i<n; i++)
+        {
+            double value;
+            memcpy(&value, in+1+i*sizeof(double), sizeof(value));
+            out[i] += value;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef _VECTOR_CODEC_H
+#define _VECTOR_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Payload encodings of "tree_sum -c". The vector is encoded in pieces of at
+// most CODEC_PIECE doubles, every piece is one message of bytes, and the
+// receiver decodes it and adds it into its partial sum in double.
+//   f32:  the elements rounded to float, half the bytes
+//   bf16: the top 16 bits of the float (round to nearest even), a quarter
+//   xor:  lossless, every element xor the previous one, cut into 8 byte
+//         planes and the zero bytes run-length coded
+#define NO_CODEC 0
+#define F32_CODEC 1
+#define BF16_CODEC 2
+#define XOR_CODEC 3
+
+#define CODEC_PIECE (1 << 20)
+
+// codec for a -c argument, -1 if unknown
+int codec_from_name(const char* name);
+const char* codec_name(int codec);
+
+// room the encoding of n doubles may need
+size_t codec_max_bytes(long long n);
+
+// encodes in[0 ... n-1] into out and returns the number of bytes used
+size_t codec_encode(int codec, const double* in, long long n, unsigned char* out);
+
+// adds the n doubles encoded in in into out, scratch has room for n values
+void codec_decode_add(int codec, const unsigned char* in, double* out, long long n, uint64_t* scratch);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <omp.h>
+#include <mpi.h>
+#include "rng.h"
+#include "pi_kernel.h"
+#include "work_share.h"
+
+#define ull unsigned long long int
+
+// samples drawn from one random stream inside a chunk
+#define SUB_BLOCK 16384
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+// guided schedule: half of the remaining work spread over the cores, but
+// never less than min_chunk. It only depends on where the chunk starts, so
+// the chunk boundaries are the same in every run.
+static ull chunk_size(ull start, ull total_samples, ull min_chunk, int p_size)
+{
+    ull size = (total_samples-start)/(2*(ull)p_size);
+    if(size < min_chunk)
+    {
+        size = min_chunk;
+    }
+    return start+size<total_samples ? size : total_samples-start;
+}
+
+// Claims the next chunk with a compare and swap on core 0's counter and
+// retries if another core got there first. Returns 0 when no work is left.
+static int next_chunk(MPI_Win window, ull total_samples, ull min_chunk, int p_size, ull* start, ull* len)
+{
+    ull seen;
+    MPI_Fetch_and_op(NULL, &seen, MPI_UNSIGNED_LONG_LONG, 0, 0, MPI_NO_OP, window);
+    MPI_Win_flush(0, window);
+    while(seen < total_samples)
+    {
+        ull size = chunk_size(seen, total_samples, min_chunk, p_size);
+        ull next = seen+size;
+        ull old;
+        MPI_Compare_and_swap(&next, &seen, &old, MPI_UNSIGNED_LONG_LONG, 0, 0, window);
+        MPI_Win_flush(0, window);
+        if(old == seen)
+        {
+            *start = seen;
+            *len = size;
+            return 1;
+        }
+        seen = old;
+    }
+    return 0;
+}
+
+ull dynamic_count_in_circle(ull total_samples, ull min_chunk, int thread_count, ull seed, int my_rank, int p_size)
+{
+    ull* counter;
+    MPI_Win window;
+    MPI_Win_allocate(0 == my_rank ? sizeof(ull) : 0, sizeof(ull), MPI_INFO_NULL, MPI_COMM_WORLD, &counter, &window);
+    if(0 == my_rank)
+    {
+        *counter = 0;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, window);
+
+    double begin = now();
+    double busy = 0;
+    ull samples = 0;
+    int chunks = 0;
+    ull in_circle_count = 0;
+    ull start, len;
+    while(next_chunk(window, total_samples, min_chunk, p_size, &start, &len))
+    {
+        double chunk_begin = now();
+        // sub-block k of the chunk uses the stream numbered by its first
+        // sample, so the estimate doesn't depend on who took the chunk
+        ull sub_blocks = (len+SUB_BLOCK-1)/SUB_BLOCK;
+        ull chunk_count = 0;
+        #pragma omp parallel for num_threads(thread_count) schedule(dynamic) reduction(+:chunk_count)
+        for(ull k=0; k<sub_blocks; k++)
+        {
+            rng_t rng;
+            ull first = start + k*SUB_BLOCK;
+            ull n = start+len-first<SUB_BLOCK ? start+len-first : SUB_BLOCK;
+            rng_init(&rng, seed, first);
+            chunk_count += pi_count_in_circle(&rng, n);
+        }
+        in_circle_count += chunk_count;
+        busy += now()-chunk_begin;
+        samples += len;
+        chunks++;
+    }
+    double finish = now();
+    MPI_Win_unlock_all(window);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double idle = now()-finish;
+    double elapsed = now()-begin;
+    MPI_Win_free(&window);
+
+    // per core report: samples, chunks, busy and idle time
+    double mine[4] = {(double)samples, (double)chunks, busy, idle};
+    double* all = NULL;
+    if(0 == my_rank)
+    {
+        all = (double*) malloc(4*p_size*sizeof(double));
+    }
+    MPI_Gather(mine, 4, MPI_DOUBLE, all, 4, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if(0 == my_rank)
+    {
+        printf("core, samples, chunks, busy time, idle time\n");
+        for(int i=0; i<p_size; i++)
+        {
+            printf("%d, %.0f, %.0f, %f, %f\n", i, all[4*i], all[4*i+1], all[4*i+2], all[4*i+3]);
+        }
+        printf("Sampling time: %f (minimum chunk %llu)\n", elapsed, min_chunk);
+        free(all);
+    }
+    return in_circle_count;
+}
@@ -0,0 +1,12 @@
+#ifndef _WORK_SHARE_H
+#define _WORK_SHARE_H
+
+// Dynamic scheduling of the pi samples for flat_pi, tree_pi and MPI_Reduce_pi.
+// The total_samples samples are handed out in chunks through a counter that
+// lives in a window on core 0, so a slow core just takes fewer chunks.
+// Returns the number of samples of this core that fell in the unit circle
+// and prints how the work and the idle time were spread over the cores.
+unsigned long long dynamic_count_in_circle(unsigned long long total_samples, unsigned long long min_chunk,
+    int thread_count, unsigned long long seed, int my_rank, int p_size);
+
+#endif
@@ -13,9 +13,9 @@
  * 2.  bin_counts[i] stores the number of measurements x in the range
  * 3.  bin_maxes[i-1] <= x < bin_maxes[i] (bin_maxes[-1] = min_meas)
  * 4.  DEBUG compile flag gives verbose output
- * 5.  The program will terminate if either the number of command line
- *     arguments is incorrect or if the search for a bin for a 
- *     measurement fails.
+ * 5.  The program will terminate if the number of command line
+ *     arguments is incorrect. Measurements outside the bins are
+ *     counted in an underflow and an overflow bin (../common/bins.h).
  *
  * IPP:  Section 2.7.1 (pp. 66 and ff.)
  */
@@ -24,6 +24,8 @@
 #include <pthread.h>
 #include <math.h>
 #include <sys/time.h>
+#include "rng.h"
+#include "bins.h"
 
 void Usage(char prog_name[]);
 double elapsed_seconds();
@@ -40,20 +42,14 @@ void Gen_data(
       float   min_meas    /* in  */, 
       float   max_meas    /* in  */, 
       float   data[]      /* out */,
-      int     data_count  /* in  */);
+      int     data_count  /* in  */,
+      unsigned long long seed /* in */);
 
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */);
-
-int Which_bin(
-      float    data         /* in */, 
-      float    bin_maxes[]  /* in */, 
-      int      bin_count    /* in */, 
-      float    min_meas     /* in */);
+      bins_t* bins        /* out */);
 
 void Print_histo(
       float    bin_maxes[]   /* in */, 
@@ -65,11 +61,12 @@ void* Assign_Bin(void* range);
 
 int bin_count;
 float min_meas, max_meas;
-float* bin_maxes;
+bins_t bins;
 int* bin_counts;
 int data_count;
 float* data;
 int thread_count;
+unsigned long long seed;
 pthread_mutex_t* bin_mutexes;
 pthread_barrier_t barrier;
 
@@ -81,23 +78,24 @@ typedef struct
 
 int main(int argc, char* argv[]) {
    /* Check and get command line args */
-   if (argc != 6) Usage(argv[0]); 
+   if (argc != 6 && argc != 7) Usage(argv[0]); 
    Get_args(argv, &bin_count, &min_meas, &max_meas, &data_count, &thread_count);
+   seed = (7 == argc) ? strtoull(argv[6], NULL, 10) : rng_time_seed();
 
    /* Allocate arrays needed */
-   bin_maxes = malloc(bin_count*sizeof(float));
-   bin_counts = malloc(bin_count*sizeof(int));
    data = malloc(data_count*sizeof(float));
 
    /* Generate the data */
-   Gen_data(min_meas, max_meas, data, data_count);
+   Gen_data(min_meas, max_meas, data, data_count, seed);
 
    /* Create bins for storing counts */
-   Gen_bins(min_meas, max_meas, bin_maxes, bin_counts, bin_count);
+   Gen_bins(argv[1], min_meas, max_meas, &bins);
+   bin_count = bins.count;
+   bin_counts = calloc(bin_count+2, sizeof(int));
 
    /* Assign data to bins */
-   bin_mutexes = malloc(bin_count*sizeof(pthread_mutex_t));
-   for(int i=0; i<bin_count; i++)
+   bin_mutexes = malloc((bin_count+2)*sizeof(pthread_mutex_t));
+   for(int i=0; i<bin_count+2; i++)
    {
       pthread_mutex_init(&bin_mutexes[i], NULL);
    }
@@ -106,7 +104,7 @@ int main(int argc, char* argv[]) {
    int s = data_count/thread_count;
    pthread_t* thread_handles = malloc(thread_count*sizeof(pthread_t));
    Range* ranges = malloc(thread_count*sizeof(Range));
-   double begin;
+   double begin = 0;
    for (int i = 0; i < thread_count; i++)
    {
       if(i<k)
@@ -131,7 +129,7 @@ int main(int argc, char* argv[]) {
    }
    double end = elapsed_seconds();
 
-   for(int i=0; i<bin_count; i++)
+   for(int i=0; i<bin_count+2; i++)
    {
       pthread_mutex_destroy(&bin_mutexes[i]);
    }
@@ -141,11 +139,12 @@ int main(int argc, char* argv[]) {
    free(thread_handles);
 
    /* Print the histogram */
-   Print_histo(bin_maxes, bin_counts, bin_count, min_meas);
+   Print_histo(bins.maxes, bin_counts, bin_count, bins.min);
    printf("Time Taken: %f\n", end-begin);
+   printf("Seed: %llu\n", seed);
    
    free(data);
-   free(bin_maxes);
+   bins_free(&bins);
    free(bin_counts);
    return 0;
 
@@ -159,7 +158,7 @@ void* Assign_Bin(void* range)
    int e = ptr->end;
    //printf("%d, %d\n", s, e);
    for (int i = s; i<e; i++) {
-      int bin = Which_bin(data[i], bin_maxes, bin_count, min_meas);
+      int bin = bins_find(&bins, data[i]);
       pthread_mutex_lock(&bin_mutexes[bin]);
       bin_counts[bin]++;
       pthread_mutex_unlock(&bin_mutexes[bin]);
@@ -182,7 +181,7 @@ double elapsed_seconds()
  */
 void Usage(char prog_name[] /* in */) {
    fprintf(stderr, "usage: %s ", prog_name); 
-   fprintf(stderr, "<bin_count> <min_meas> <max_meas> <data_count> <thread_count>\n");
+   fprintf(stderr, "<bin_count|edge_file> <min_meas> <max_meas> <data_count> <thread_count> [seed]\n");
    exit(0);
 }  /* Usage */
 
@@ -224,25 +223,27 @@ void Get_args(
  * In args:   min_meas:    the minimum possible value for the data
  *            max_meas:    the maximum possible value for the data
  *            data_count:  the number of measurements
+ *            seed:        seed of the random number generator
  * Out arg:   data:        the actual measurements
  */
 void Gen_data(
         float   min_meas    /* in  */, 
         float   max_meas    /* in  */, 
         float   data[]      /* out */,
-        int     data_count  /* in  */) {
+        int     data_count  /* in  */,
+        unsigned long long seed /* in */) {
    int i;
+   rng_t rng;
 
-   srandom(time(NULL));
+   rng_init(&rng, seed, 0);
+   rng_fill_float(&rng, data, data_count);
    for (i = 0; i < data_count; i++)
    {
-      double data_val = min_meas + (max_meas - min_meas)*random()/((double) RAND_MAX);
-      if(data_val>=max_meas) // max_meas doesn't belong in the histogram
+      data[i] = min_meas + (max_meas - min_meas)*data[i];
+      while(data[i]>=max_meas) // max_meas doesn't belong in the histogram
       {
-         i--;
-         continue;
+         data[i] = min_meas + (max_meas - min_meas)*rng_next_float(&rng);
       }
-      data[i] = data_val;
    }
 
 #  ifdef DEBUG
@@ -256,83 +257,30 @@ void Gen_data(
 
 /*---------------------------------------------------------------------
  * Function:  Gen_bins
- * Purpose:   Compute max value for each bin, and store 0 as the
- *            number of values in each bin
- * In args:   min_meas:   the minimum possible measurement
+ * Purpose:   Compute the edges of the bins: bin_arg equal bins from
+ *            min_meas to max_meas, or the edges in the file bin_arg
+ * In args:   bin_arg:    the <bin_count> argument
+ *            min_meas:   the minimum possible measurement
  *            max_meas:   the maximum possible measurement
- *            bin_count:  the number of bins
- * Out args:  bin_maxes:  the maximum possible value for each bin
- *            bin_counts: the number of data values in each bin
+ * Out arg:   bins:       the edges of the bins, see ../common/bins.h
  */
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */) {
-   float bin_width;
-   int   i;
-
-   bin_width = (max_meas - min_meas)/bin_count;
-
-   for (i = 0; i < bin_count; i++) {
-      bin_maxes[i] = min_meas + (i+1)*bin_width;
-      bin_counts[i] = 0;
-   }
+      bins_t* bins        /* out */) {
+   if (0 != bins_parse(bins, bin_arg, min_meas, max_meas))
+      exit(-1);
 
 #  ifdef DEBUG
    printf("bin_maxes = ");
-   for (i = 0; i < bin_count; i++)
-      printf("%4.3f ", bin_maxes[i]);
+   for (int i = 0; i < bins->count; i++)
+      printf("%4.3f ", bins->maxes[i]);
    printf("\n");
 #  endif
 }  /* Gen_bins */
 
 
-/*---------------------------------------------------------------------
- * Function:  Which_bin
- * Purpose:   Use binary search to determine which bin a measurement 
- *            belongs to
- * In args:   data:       the current measurement
- *            bin_maxes:  list of max bin values
- *            bin_count:  number of bins
- *            min_meas:   the minimum possible measurement
- * Return:    the number of the bin to which data belongs
- * Notes:      
- * 1.  The bin to which data belongs satisfies
- *
- *            bin_maxes[i-1] <= data < bin_maxes[i] 
- *
- *     where, bin_maxes[-1] = min_meas
- * 2.  If the search fails, the function prints a message and exits
- */
-int Which_bin(
-      float   data          /* in */, 
-      float   bin_maxes[]   /* in */, 
-      int     bin_count     /* in */, 
-      float   min_meas      /* in */) {
-   int bottom = 0, top =  bin_count-1;
-   int mid;
-   float bin_max, bin_min;
-
-   while (bottom <= top) {
-      mid = (bottom + top)/2;
-      bin_max = bin_maxes[mid];
-      bin_min = (mid == 0) ? min_meas: bin_maxes[mid-1];
-      if (data >= bin_max) 
-         bottom = mid+1;
-      else if (data < bin_min)
-         top = mid-1;
-      else
-         return mid;
-   }
-   /* Whoops! */
-   fprintf(stderr, "Data = %f doesn't belong to a bin!\n", data);
-   fprintf(stderr, "Quitting\n");
-   exit(-1);
-}  /* Which_bin */
-
-
 /*---------------------------------------------------------------------
  * Function:  Print_histo
  * Purpose:   Print a histogram.  The number of elements in each
@@ -356,10 +304,14 @@ void Print_histo(
    {
       largest_bin_count = largest_bin_count<bin_counts[i] ? bin_counts[i] : largest_bin_count;
    }
-   for(i=0; i<bin_count; i++)
+   // an edge file may put every value outside the bins
+   if(0 < largest_bin_count)
    {
-      double ratio = (double) bin_counts[i] / (double) largest_bin_count;
-      bin_counts[i] = round((double)normal_factor*ratio);
+      for(i=0; i<bin_count; i++)
+      {
+         double ratio = (double) bin_counts[i] / (double) largest_bin_count;
+         bin_counts[i] = round((double)normal_factor*ratio);
+      }
    }
 
    for (i = 0; i < bin_count; i++) {
@@ -370,4 +322,7 @@ void Print_histo(
          printf("X");
       printf("\n");
    }
+   if (bin_counts[bin_count] > 0 || bin_counts[bin_count+1] > 0)
+      printf("Below %.3f: %d, at or above %.3f: %d\n", min_meas, bin_counts[bin_count],
+            bin_maxes[bin_count-1], bin_counts[bin_count+1]);
 }  /* Print_histo */
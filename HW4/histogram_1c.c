@@ -0,0 +1,383 @@
+/* File:      histogram.c
+ * Purpose:   Build a histogram from some random data
+ * 
+ * Compile:   gcc -g -Wall -o histogram histogram.c
+ * Run:       ./histogram <bin_count> <min_meas> <max_meas> <data_count>
+ *
+ * Input:     None
+ * Output:    A histogram with X's showing the number of measurements
+ *            in each bin
+ *
+ * Notes:
+ * 1.  Actual measurements y are in the range min_meas <= y < max_meas
+ * 2.  bin_counts[i] stores the number of measurements x in the range
+ * 3.  bin_maxes[i-1] <= x < bin_maxes[i] (bin_maxes[-1] = min_meas)
+ * 4.  DEBUG compile flag gives verbose output
+ * 5.  The program will terminate if the number of command line
+ *     arguments is incorrect. Measurements outside the bins are
+ *     counted in an underflow and an overflow bin (../common/bins.h).
+ *
+ * IPP:  Section 2.7.1 (pp. 66 and ff.)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <math.h>
+#include <sys/time.h>
+#include "rng.h"
+#include "bins.h"
+
+void Usage(char prog_name[]);
+double elapsed_seconds();
+
+void Get_args(
+      char*    argv[]        /* in  */,
+      int*     bin_count_p   /* out */,
+      float*   min_meas_p    /* out */,
+      float*   max_meas_p    /* out */,
+      int*     data_count_p  /* out */,
+      int*     thread_count  /* out */);
+
+void Gen_data(
+      float   min_meas    /* in  */, 
+      float   max_meas    /* in  */, 
+      float   data[]      /* out */,
+      int     data_count  /* in  */,
+      unsigned long long seed /* in */);
+
+void Gen_bins(
+      char  bin_arg[]     /* in  */,
+      float min_meas      /* in  */, 
+      float max_meas      /* in  */, 
+      bins_t* bins        /* out */);
+
+void Print_histo(
+      float    bin_maxes[]   /* in */, 
+      int      bin_counts[]  /* in */, 
+      int      bin_count     /* in */, 
+      float    min_meas      /* in */);
+
+void* Assign_Bin(void* range);
+void Tree_merge(int id);
+void Range_merge(int id);
+
+/* ints per cache line; every private histogram starts on its own line */
+#define LINE_INTS 16
+/* the bin-range merge is used when every thread gets at least this many bins */
+#define RANGE_MERGE_BINS 1024
+
+int bin_count;
+float min_meas, max_meas;
+bins_t bins;
+int* bin_counts;
+int data_count;
+float* data;
+int thread_count;
+unsigned long long seed;
+int padded_count;   /* bin_count+2 rounded up to whole cache lines */
+int* private_counts; /* thread_count histograms of padded_count bins */
+int range_merge;
+pthread_barrier_t barrier;
+
+typedef struct 
+{
+   int start;
+   int end;
+   int id;
+} Range;
+
+int main(int argc, char* argv[]) {
+   /* Check and get command line args */
+   if (argc != 6 && argc != 7) Usage(argv[0]); 
+   Get_args(argv, &bin_count, &min_meas, &max_meas, &data_count, &thread_count);
+   seed = (7 == argc) ? strtoull(argv[6], NULL, 10) : rng_time_seed();
+
+   /* Allocate arrays needed */
+   data = malloc(data_count*sizeof(float));
+
+   /* Generate the data */
+   Gen_data(min_meas, max_meas, data, data_count, seed);
+
+   /* Create bins for storing counts */
+   Gen_bins(argv[1], min_meas, max_meas, &bins);
+   bin_count = bins.count;
+   bin_counts = calloc(bin_count+2, sizeof(int));
+
+   /* Assign data to bins: every thread counts into its own histogram,
+      then the histograms are merged by all threads */
+   padded_count = (bin_count+2+LINE_INTS-1)/LINE_INTS*LINE_INTS;
+   private_counts = aligned_alloc(LINE_INTS*sizeof(int), (size_t)thread_count*padded_count*sizeof(int));
+   range_merge = bin_count/thread_count >= RANGE_MERGE_BINS;
+   pthread_barrier_init(&barrier, NULL, thread_count);
+   int k = data_count%thread_count;
+   int s = data_count/thread_count;
+   pthread_t* thread_handles = malloc(thread_count*sizeof(pthread_t));
+   Range* ranges = malloc(thread_count*sizeof(Range));
+   double begin = 0;
+   for (int i = 0; i < thread_count; i++)
+   {
+      if(i<k)
+      {
+         ranges[i].start = i*s+i;
+         ranges[i].end = ranges[i].start+s+1;
+      }
+      else
+      {
+         ranges[i].start = i*s+k;
+         ranges[i].end = ranges[i].start+s;
+      }
+      ranges[i].id = i;
+      if(i == thread_count-1)
+      {
+         begin = elapsed_seconds();
+      }
+      pthread_create(&thread_handles[i], NULL, Assign_Bin, (void*) &ranges[i]);
+   }
+   for(int i=0; i<thread_count; i++)
+   {
+      pthread_join(thread_handles[i], NULL);
+   }
+   double end = elapsed_seconds();
+
+   pthread_barrier_destroy(&barrier);
+   free(private_counts);
+   free(ranges);
+   free(thread_handles);
+
+   /* Print the histogram */
+   Print_histo(bins.maxes, bin_counts, bin_count, bins.min);
+   printf("Merge: %s\n", range_merge ? "bin ranges" : "tree");
+   printf("Time Taken: %f\n", end-begin);
+   printf("Seed: %llu\n", seed);
+   
+   free(data);
+   bins_free(&bins);
+   free(bin_counts);
+   return 0;
+
+}  /* main */
+
+void* Assign_Bin(void* range)
+{
+   pthread_barrier_wait(&barrier);
+   Range* ptr = (Range*) range;
+   int s = ptr->start;
+   int e = ptr->end;
+   int* my_counts = private_counts + (size_t)ptr->id*padded_count;
+   for (int i = 0; i < padded_count; i++)
+      my_counts[i] = 0;
+   /* the SIMD kernel counts into sub-histograms, which are then added to
+      this thread's histogram */
+   int* sub = bins_subcounts(&bins);
+   bins_count(&bins, data+s, e-s, sub);
+   bins_fold(&bins, sub, my_counts);
+   pthread_barrier_wait(&barrier);
+   if(range_merge)
+      Range_merge(ptr->id);
+   else
+      Tree_merge(ptr->id);
+   return NULL;
+}
+
+/* Pairs of histograms are added in log2(thread_count) rounds: in the round
+   with distance d, thread id (a multiple of 2d) adds histogram id+d into its
+   own. Thread 0 ends with the total and copies it to bin_counts. */
+void Tree_merge(int id)
+{
+   for(int d=1; d<thread_count; d*=2)
+   {
+      if(0 == id%(2*d) && id+d < thread_count)
+      {
+         int* mine = private_counts + (size_t)id*padded_count;
+         int* other = private_counts + (size_t)(id+d)*padded_count;
+         for(int i=0; i<bin_count+2; i++)
+            mine[i] += other[i];
+      }
+      pthread_barrier_wait(&barrier);
+   }
+   if(0 == id)
+   {
+      for(int i=0; i<bin_count+2; i++)
+         bin_counts[i] = private_counts[i];
+   }
+}
+
+/* Every thread sums one range of bins over all histograms, so each bin is
+   added up once. The ranges are whole cache lines, so no two threads write
+   to the same line of bin_counts. */
+void Range_merge(int id)
+{
+   int lines = padded_count/LINE_INTS;
+   int first = (int)((long long)lines*id/thread_count)*LINE_INTS;
+   int last = (int)((long long)lines*(id+1)/thread_count)*LINE_INTS;
+   if(last > bin_count+2)
+      last = bin_count+2;
+   for(int i=first; i<last; i++)
+   {
+      int sum = 0;
+      for(int t=0; t<thread_count; t++)
+         sum += private_counts[(size_t)t*padded_count+i];
+      bin_counts[i] = sum;
+   }
+}
+
+double elapsed_seconds()
+{
+   struct timeval tv;
+   struct timezone tz;
+   gettimeofday(&tv, &tz);
+   return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/*---------------------------------------------------------------------
+ * Function:  Usage 
+ * Purpose:   Print a message showing how to run program and quit
+ * In arg:    prog_name:  the name of the program from the command line
+ */
+void Usage(char prog_name[] /* in */) {
+   fprintf(stderr, "usage: %s ", prog_name); 
+   fprintf(stderr, "<bin_count|edge_file> <min_meas> <max_meas> <data_count> <thread_count> [seed]\n");
+   exit(0);
+}  /* Usage */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Get_args
+ * Purpose:   Get the command line arguments
+ * In arg:    argv:  strings from command line
+ * Out args:  bin_count_p:   number of bins
+ *            min_meas_p:    minimum measurement
+ *            max_meas_p:    maximum measurement
+ *            data_count_p:  number of measurements
+ */
+void Get_args(
+      char*    argv[]        /* in  */,
+      int*     bin_count_p   /* out */,
+      float*   min_meas_p    /* out */,
+      float*   max_meas_p    /* out */,
+      int*     data_count_p  /* out */,
+      int*     thread_count  /* out */) {
+
+   *bin_count_p = strtol(argv[1], NULL, 10);
+   *min_meas_p = strtof(argv[2], NULL);
+   *max_meas_p = strtof(argv[3], NULL);
+   *data_count_p = strtol(argv[4], NULL, 10);
+   *thread_count = strtol(argv[5], NULL, 10);
+
+#  ifdef DEBUG
+   printf("bin_count = %d\n", *bin_count_p);
+   printf("min_meas = %f, max_meas = %f\n", *min_meas_p, *max_meas_p);
+   printf("data_count = %d\n", *data_count_p);
+#  endif
+}  /* Get_args */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Gen_data
+ * Purpose:   Generate random floats in the range min_meas <= x < max_meas
+ * In args:   min_meas:    the minimum possible value for the data
+ *            max_meas:    the maximum possible value for the data
+ *            data_count:  the number of measurements
+ *            seed:        seed of the random number generator
+ * Out arg:   data:        the actual measurements
+ */
+void Gen_data(
+        float   min_meas    /* in  */, 
+        float   max_meas    /* in  */, 
+        float   data[]      /* out */,
+        int     data_count  /* in  */,
+        unsigned long long seed /* in */) {
+   int i;
+   rng_t rng;
+
+   rng_init(&rng, seed, 0);
+   rng_fill_float(&rng, data, data_count);
+   for (i = 0; i < data_count; i++)
+   {
+      data[i] = min_meas + (max_meas - min_meas)*data[i];
+      while(data[i]>=max_meas) // max_meas doesn't belong in the histogram
+      {
+         data[i] = min_meas + (max_meas - min_meas)*rng_next_float(&rng);
+      }
+   }
+
+#  ifdef DEBUG
+   printf("data = ");
+   for (i = 0; i < data_count; i++)
+      printf("%4.3f ", data[i]);
+   printf("\n");
+#  endif
+}  /* Gen_data */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Gen_bins
+ * Purpose:   Compute the edges of the bins: bin_arg equal bins from
+ *            min_meas to max_meas, or the edges in the file bin_arg
+ * In args:   bin_arg:    the <bin_count> argument
+ *            min_meas:   the minimum possible measurement
+ *            max_meas:   the maximum possible measurement
+ * Out arg:   bins:       the edges of the bins, see ../common/bins.h
+ */
+void Gen_bins(
+      char  bin_arg[]     /* in  */,
+      float min_meas      /* in  */, 
+      float max_meas      /* in  */, 
+      bins_t* bins        /* out */) {
+   if (0 != bins_parse(bins, bin_arg, min_meas, max_meas))
+      exit(-1);
+
+#  ifdef DEBUG
+   printf("bin_maxes = ");
+   for (int i = 0; i < bins->count; i++)
+      printf("%4.3f ", bins->maxes[i]);
+   printf("\n");
+#  endif
+}  /* Gen_bins */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Print_histo
+ * Purpose:   Print a histogram.  The number of elements in each
+ *            bin is shown by an array of X's.
+ * In args:   bin_maxes:   the max value for each bin
+ *            bin_counts:  the number of elements in each bin
+ *            bin_count:   the number of bins
+ *            min_meas:    the minimum possible measurment
+ */
+void Print_histo(
+        float  bin_maxes[]   /* in */, 
+        int    bin_counts[]  /* in */, 
+        int    bin_count     /* in */, 
+        float  min_meas      /* in */) {
+   int i, j;
+   float bin_max, bin_min;
+   // normalizing
+   int normal_factor = 100;
+   int largest_bin_count = bin_counts[0];
+   for(i=1; i<bin_count; i++)
+   {
+      largest_bin_count = largest_bin_count<bin_counts[i] ? bin_counts[i] : largest_bin_count;
+   }
+   // an edge file may put every value outside the bins
+   if(0 < largest_bin_count)
+   {
+      for(i=0; i<bin_count; i++)
+      {
+         double ratio = (double) bin_counts[i] / (double) largest_bin_count;
+         bin_counts[i] = round((double)normal_factor*ratio);
+      }
+   }
+
+   for (i = 0; i < bin_count; i++) {
+      bin_max = bin_maxes[i];
+      bin_min = (i == 0) ? min_meas: bin_maxes[i-1];
+      printf("%.3f-%.3f:\t", bin_min, bin_max);
+      for (j = 0; j < bin_counts[i]; j++)
+         printf("X");
+      printf("\n");
+   }
+   if (bin_counts[bin_count] > 0 || bin_counts[bin_count+1] > 0)
+      printf("Below %.3f: %d, at or above %.3f: %d\n", min_meas, bin_counts[bin_count],
+            bin_maxes[bin_count-1], bin_counts[bin_count+1]);
+}  /* Print_histo */
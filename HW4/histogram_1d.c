@@ -0,0 +1,441 @@
+/* File:      histogram.c
+ * Purpose:   Build a histogram from some random data
+ * 
+ * Compile:   gcc -g -Wall -o histogram histogram.c
+ * Run:       ./histogram <bin_count> <min_meas> <max_meas> <data_count>
+ *            (histogram_1d: [-p] [-k <stripes>] [-s <skew>] [-l] before
+ *            the arguments, see Usage)
+ *
+ * Input:     None
+ * Output:    A histogram with X's showing the number of measurements
+ *            in each bin
+ *
+ * Notes:
+ * 1.  Actual measurements y are in the range min_meas <= y < max_meas
+ * 2.  bin_counts[i] stores the number of measurements x in the range
+ * 3.  bin_maxes[i-1] <= x < bin_maxes[i] (bin_maxes[-1] = min_meas)
+ * 4.  DEBUG compile flag gives verbose output
+ * 5.  The program will terminate if the number of command line
+ *     arguments is incorrect. Measurements outside the bins are
+ *     counted in an underflow and an overflow bin (../common/bins.h).
+ *
+ * IPP:  Section 2.7.1 (pp. 66 and ff.)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/time.h>
+#include "rng.h"
+#include "bins.h"
+
+void Usage(char prog_name[]);
+double elapsed_seconds();
+
+void Get_args(
+      char*    argv[]        /* in  */,
+      int*     bin_count_p   /* out */,
+      float*   min_meas_p    /* out */,
+      float*   max_meas_p    /* out */,
+      int*     data_count_p  /* out */,
+      int*     thread_count  /* out */);
+
+void Gen_data(
+      float   min_meas    /* in  */, 
+      float   max_meas    /* in  */, 
+      float   data[]      /* out */,
+      int     data_count  /* in  */,
+      unsigned long long seed /* in */,
+      float   skew        /* in  */,
+      bins_t* bins        /* in  */);
+
+void Gen_bins(
+      char  bin_arg[]     /* in  */,
+      float min_meas      /* in  */, 
+      float max_meas      /* in  */, 
+      bins_t* bins        /* out */);
+
+void Print_histo(
+      float    bin_maxes[]   /* in */, 
+      int      bin_counts[]  /* in */, 
+      int      bin_count     /* in */, 
+      float    min_meas      /* in */);
+
+void* Assign_Bin(void* range);
+
+/* ints per cache line */
+#define LINE_INTS 16
+/* with -s the skewed values go to this many bins at the bottom */
+#define HOT_BINS 4
+
+int bin_count;
+float min_meas, max_meas;
+bins_t bins;
+int* bin_counts;
+int data_count;
+float* data;
+int thread_count;
+unsigned long long seed;
+pthread_mutex_t* bin_mutexes;
+pthread_barrier_t barrier;
+/* Counter c of stripe t is atomic_counts[(t*stripe_size+c)*spacing]. With
+   -p (padded) spacing is a cache line, else 1; every stripe starts on its
+   own line either way. Thread id increments stripe id%stripe_count. */
+atomic_int* atomic_counts;
+int stripe_count = 1;
+int stripe_size;
+int spacing = 1;
+int use_mutexes = 0;
+
+typedef struct 
+{
+   int start;
+   int end;
+   int id;
+} Range;
+
+int main(int argc, char* argv[]) {
+   /* Check and get command line args */
+   float skew = 0;
+   struct option long_options[] =
+   {
+      {"padded", no_argument, NULL, 'p'},
+      {"stripes", required_argument, NULL, 'k'},
+      {"skew", required_argument, NULL, 's'},
+      {"locks", no_argument, NULL, 'l'},
+      {0, 0, 0, 0}
+   };
+   int optchar;
+   while(-1 != (optchar = getopt_long(argc, argv, "pk:s:l", long_options, NULL)))
+   {
+      switch(optchar)
+      {
+         case 'p':
+            spacing = LINE_INTS;
+            break;
+         case 'k':
+            stripe_count = strtol(optarg, NULL, 10);
+            break;
+         case 's':
+            skew = strtof(optarg, NULL);
+            break;
+         case 'l':
+            use_mutexes = 1;
+            break;
+         default:
+            Usage(argv[0]);
+      }
+   }
+   char* prog_name = argv[0];
+   argc -= optind-1;
+   argv += optind-1;
+   if ((argc != 6 && argc != 7) || stripe_count < 1 || skew < 0 || skew > 1) Usage(prog_name); 
+   Get_args(argv, &bin_count, &min_meas, &max_meas, &data_count, &thread_count);
+   seed = (7 == argc) ? strtoull(argv[6], NULL, 10) : rng_time_seed();
+
+   /* Allocate arrays needed */
+   data = malloc(data_count*sizeof(float));
+
+   /* Create bins for storing counts */
+   Gen_bins(argv[1], min_meas, max_meas, &bins);
+   bin_count = bins.count;
+   bin_counts = calloc(bin_count+2, sizeof(int));
+
+   /* Generate the data */
+   Gen_data(min_meas, max_meas, data, data_count, seed, skew, &bins);
+
+   /* Assign data to bins, with per-bin mutexes as histogram_1b for -l,
+      else with atomic counters */
+   bin_mutexes = malloc((bin_count+2)*sizeof(pthread_mutex_t));
+   for(int i=0; i<bin_count+2; i++)
+   {
+      pthread_mutex_init(&bin_mutexes[i], NULL);
+   }
+   stripe_size = (bin_count+2+LINE_INTS-1)/LINE_INTS*LINE_INTS;
+   size_t counters = (size_t)stripe_count*stripe_size*spacing;
+   atomic_counts = aligned_alloc(LINE_INTS*sizeof(int), counters*sizeof(atomic_int));
+   for(size_t i=0; i<counters; i++)
+   {
+      atomic_init(&atomic_counts[i], 0);
+   }
+   pthread_barrier_init(&barrier, NULL, thread_count);
+   int k = data_count%thread_count;
+   int s = data_count/thread_count;
+   pthread_t* thread_handles = malloc(thread_count*sizeof(pthread_t));
+   Range* ranges = malloc(thread_count*sizeof(Range));
+   double begin = 0;
+   for (int i = 0; i < thread_count; i++)
+   {
+      if(i<k)
+      {
+         ranges[i].start = i*s+i;
+         ranges[i].end = ranges[i].start+s+1;
+      }
+      else
+      {
+         ranges[i].start = i*s+k;
+         ranges[i].end = ranges[i].start+s;
+      }
+      ranges[i].id = i;
+      if(i == thread_count-1)
+      {
+         begin = elapsed_seconds();
+      }
+      pthread_create(&thread_handles[i], NULL, Assign_Bin, (void*) &ranges[i]);
+   }
+   for(int i=0; i<thread_count; i++)
+   {
+      pthread_join(thread_handles[i], NULL);
+   }
+   /* sum up the stripes, the joins order them after all increments */
+   for(int i=0; i<bin_count+2 && !use_mutexes; i++)
+   {
+      bin_counts[i] = 0;
+      for(int t=0; t<stripe_count; t++)
+      {
+         bin_counts[i] += atomic_load_explicit(&atomic_counts[((size_t)t*stripe_size+i)*spacing], memory_order_relaxed);
+      }
+   }
+   double end = elapsed_seconds();
+
+   for(int i=0; i<bin_count+2; i++)
+   {
+      pthread_mutex_destroy(&bin_mutexes[i]);
+   }
+   pthread_barrier_destroy(&barrier);
+   free(bin_mutexes);
+   free(atomic_counts);
+   free(ranges);
+   free(thread_handles);
+
+   /* Print the histogram */
+   Print_histo(bins.maxes, bin_counts, bin_count, bins.min);
+   if(use_mutexes)
+      printf("Counters: per-bin mutexes\n");
+   else
+      printf("Counters: atomic, %s, %d stripe(s)\n", LINE_INTS==spacing ? "padded" : "packed", stripe_count);
+   printf("Skew: %.3f of the values in the lowest %d bins\n", skew, HOT_BINS<bin_count ? HOT_BINS : bin_count);
+   printf("Time Taken: %f\n", end-begin);
+   printf("Seed: %llu\n", seed);
+   
+   free(data);
+   bins_free(&bins);
+   free(bin_counts);
+   return 0;
+
+}  /* main */
+
+void* Assign_Bin(void* range)
+{
+   pthread_barrier_wait(&barrier);
+   Range* ptr = (Range*) range;
+   int s = ptr->start;
+   int e = ptr->end;
+   if(use_mutexes)
+   {
+      for (int i = s; i<e; i++) {
+         int bin = bins_find(&bins, data[i]);
+         pthread_mutex_lock(&bin_mutexes[bin]);
+         bin_counts[bin]++;
+         pthread_mutex_unlock(&bin_mutexes[bin]);
+      }
+      return NULL;
+   }
+   /* relaxed is enough: nothing else is published through the counters */
+   atomic_int* my_stripe = atomic_counts + (size_t)(ptr->id%stripe_count)*stripe_size*spacing;
+   for (int i = s; i<e; i++) {
+      int bin = bins_find(&bins, data[i]);
+      atomic_fetch_add_explicit(&my_stripe[bin*spacing], 1, memory_order_relaxed);
+   }
+   return NULL;
+}
+
+double elapsed_seconds()
+{
+   struct timeval tv;
+   struct timezone tz;
+   gettimeofday(&tv, &tz);
+   return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/*---------------------------------------------------------------------
+ * Function:  Usage 
+ * Purpose:   Print a message showing how to run program and quit
+ * In arg:    prog_name:  the name of the program from the command line
+ */
+void Usage(char prog_name[] /* in */) {
+   fprintf(stderr, "usage: %s ", prog_name); 
+   fprintf(stderr, "[-p] [-k <stripes>] [-s <skew>] [-l] <bin_count|edge_file> <min_meas> <max_meas> <data_count> <thread_count> [seed]\n");
+   fprintf(stderr, "  -p, --padded         every counter on its own cache line\n");
+   fprintf(stderr, "  -k, --stripes <k>    k copies of every counter, spread over the threads\n");
+   fprintf(stderr, "  -s, --skew <f>       a fraction f of the values in the lowest bins\n");
+   fprintf(stderr, "  -l, --locks          per-bin mutexes instead of atomics (histogram_1b)\n");
+   exit(0);
+}  /* Usage */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Get_args
+ * Purpose:   Get the command line arguments
+ * In arg:    argv:  strings from command line
+ * Out args:  bin_count_p:   number of bins
+ *            min_meas_p:    minimum measurement
+ *            max_meas_p:    maximum measurement
+ *            data_count_p:  number of measurements
+ */
+void Get_args(
+      char*    argv[]        /* in  */,
+      int*     bin_count_p   /* out */,
+      float*   min_meas_p    /* out */,
+      float*   max_meas_p    /* out */,
+      int*     data_count_p  /* out */,
+      int*     thread_count  /* out */) {
+
+   *bin_count_p = strtol(argv[1], NULL, 10);
+   *min_meas_p = strtof(argv[2], NULL);
+   *max_meas_p = strtof(argv[3], NULL);
+   *data_count_p = strtol(argv[4], NULL, 10);
+   *thread_count = strtol(argv[5], NULL, 10);
+
+#  ifdef DEBUG
+   printf("bin_count = %d\n", *bin_count_p);
+   printf("min_meas = %f, max_meas = %f\n", *min_meas_p, *max_meas_p);
+   printf("data_count = %d\n", *data_count_p);
+#  endif
+}  /* Get_args */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Gen_data
+ * Purpose:   Generate random floats in the range min_meas <= x < max_meas
+ * In args:   min_meas:    the minimum possible value for the data
+ *            max_meas:    the maximum possible value for the data
+ *            data_count:  the number of measurements
+ *            seed:        seed of the random number generator
+ *            skew:        fraction of the values put into the lowest
+ *                         HOT_BINS bins instead of the whole range
+ *            bins:        the bins
+ * Out arg:   data:        the actual measurements
+ */
+void Gen_data(
+        float   min_meas    /* in  */, 
+        float   max_meas    /* in  */, 
+        float   data[]      /* out */,
+        int     data_count  /* in  */,
+        unsigned long long seed /* in */,
+        float   skew        /* in  */,
+        bins_t* bins        /* in  */) {
+   int i;
+   rng_t rng, hot_rng;
+
+   rng_init(&rng, seed, 0);
+   rng_fill_float(&rng, data, data_count);
+   for (i = 0; i < data_count; i++)
+   {
+      data[i] = min_meas + (max_meas - min_meas)*data[i];
+      while(data[i]>=max_meas) // max_meas doesn't belong in the histogram
+      {
+         data[i] = min_meas + (max_meas - min_meas)*rng_next_float(&rng);
+      }
+   }
+   /* the hot values come from a second stream, so skew 0 gives the same
+      data as the other programs */
+   float hot_min = bins->min;
+   float hot_max = bins->maxes[(HOT_BINS<bins->count ? HOT_BINS : bins->count)-1];
+   if(0 < skew && hot_min < hot_max)
+   {
+      rng_init(&hot_rng, seed, 1);
+      for (i = 0; i < data_count; i++)
+      {
+         if(rng_next_float(&hot_rng) < skew)
+         {
+            do
+            {
+               data[i] = hot_min + (hot_max - hot_min)*rng_next_float(&hot_rng);
+            } while(data[i]>=hot_max);
+         }
+      }
+   }
+
+#  ifdef DEBUG
+   printf("data = ");
+   for (i = 0; i < data_count; i++)
+      printf("%4.3f ", data[i]);
+   printf("\n");
+#  endif
+}  /* Gen_data */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Gen_bins
+ * Purpose:   Compute the edges of the bins: bin_arg equal bins from
+ *            min_meas to max_meas, or the edges in the file bin_arg
+ * In args:   bin_arg:    the <bin_count> argument
+ *            min_meas:   the minimum possible measurement
+ *            max_meas:   the maximum possible measurement
+ * Out arg:   bins:       the edges of the bins, see ../common/bins.h
+ */
+void Gen_bins(
+      char  bin_arg[]     /* in  */,
+      float min_meas      /* in  */, 
+      float max_meas      /* in  */, 
+      bins_t* bins        /* out */) {
+   if (0 != bins_parse(bins, bin_arg, min_meas, max_meas))
+      exit(-1);
+
+#  ifdef DEBUG
+   printf("bin_maxes = ");
+   for (int i = 0; i < bins->count; i++)
+      printf("%4.3f ", bins->maxes[i]);
+   printf("\n");
+#  endif
+}  /* Gen_bins */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Print_histo
+ * Purpose:   Print a histogram.  The number of elements in each
+ *            bin is shown by an array of X's.
+ * In args:   bin_maxes:   the max value for each bin
+ *            bin_counts:  the number of elements in each bin
+ *            bin_count:   the number of bins
+ *            min_meas:    the minimum possible measurment
+ */
+void Print_histo(
+        float  bin_maxes[]   /* in */, 
+        int    bin_counts[]  /* in */, 
+        int    bin_count     /* in */, 
+        float  min_meas      /* in */) {
+   int i, j;
+   float bin_max, bin_min;
+   // normalizing
+   int normal_factor = 100;
+   int largest_bin_count = bin_counts[0];
+   for(i=1; i<bin_count; i++)
+   {
+      largest_bin_count = largest_bin_count<bin_counts[i] ? bin_counts[i] : largest_bin_count;
+   }
+   // an edge file may put every value outside the bins
+   if(0 < largest_bin_count)
+   {
+      for(i=0; i<bin_count; i++)
+      {
+         double ratio = (double) bin_counts[i] / (double) largest_bin_count;
+         bin_counts[i] = round((double)normal_factor*ratio);
+      }
+   }
+
+   for (i = 0; i < bin_count; i++) {
+      bin_max = bin_maxes[i];
+      bin_min = (i == 0) ? min_meas: bin_maxes[i-1];
+      printf("%.3f-%.3f:\t", bin_min, bin_max);
+      for (j = 0; j < bin_counts[i]; j++)
+         printf("X");
+      printf("\n");
+   }
+   if (bin_counts[bin_count] > 0 || bin_counts[bin_count+1] > 0)
+      printf("Below %.3f: %d, at or above %.3f: %d\n", min_meas, bin_counts[bin_count],
+            bin_maxes[bin_count-1], bin_counts[bin_count+1]);
+}  /* Print_histo */
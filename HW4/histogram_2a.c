@@ -13,19 +13,23 @@
  * 2.  bin_counts[i] stores the number of measurements x in the range
  * 3.  bin_maxes[i-1] <= x < bin_maxes[i] (bin_maxes[-1] = min_meas)
  * 4.  DEBUG compile flag gives verbose output
- * 5.  The program will terminate if either the number of command line
- *     arguments is incorrect or if the search for a bin for a 
- *     measurement fails.
+ * 5.  The program will terminate if the number of command line
+ *     arguments is incorrect. Measurements outside the bins are
+ *     counted in an underflow and an overflow bin (../common/bins.h).
  *
  * IPP:  Section 2.7.1 (pp. 66 and ff.)
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <math.h>
 #include <sys/time.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "rng.h"
+#include "bins.h"
 
 void Usage(char prog_name[]);
 double elapsed_seconds();
@@ -40,17 +44,10 @@ void Get_args(
       int*     con_count     /* out */);
 
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */);
-
-int Which_bin(
-      float    data         /* in */, 
-      float    bin_maxes[]  /* in */, 
-      int      bin_count    /* in */, 
-      float    min_meas     /* in */);
+      bins_t* bins        /* out */);
 
 void Print_histo(
       float    bin_maxes[]   /* in */, 
@@ -61,127 +58,214 @@ void Print_histo(
 
 int bin_count;
 float min_meas, max_meas;
-float* bin_maxes;
+bins_t bins;
 int* bin_counts;
 int data_count;
 int pro_count, con_count;
-pthread_mutex_t* bin_mutexes;
-
-int* data_index_queue;
-int queue_size;
-int sampled_data_count;
-int pro_index, con_index;
-sem_t available_data_count;
-pthread_mutex_t pro_mutex, con_mutex;
+
+/* The queue of bin indices is a bounded lock-free ring for many producers
+   and consumers (D. Vyukov's MPMC queue). Every cell carries a sequence
+   number: a producer may fill cell pos%QUEUE_SIZE when its sequence is pos,
+   a consumer may empty it when it is pos+1. head and tail are claimed with
+   a compare-and-swap and live on their own cache lines. */
+#define QUEUE_SIZE 1024 /* a power of two */
+
+typedef struct
+{
+   atomic_size_t sequence;
+   int bin;
+} Cell;
+
+typedef struct
+{
+   _Alignas(64) atomic_size_t head; /* next position to fill */
+   _Alignas(64) atomic_size_t tail; /* next position to empty */
+   _Alignas(64) Cell cells[QUEUE_SIZE];
+} Ring;
+
+Ring queue;
+atomic_int sampled_data_count; /* values claimed by producers */
+atomic_int producers_left;
 pthread_barrier_t barrier;
 
-void* producer(void* seed)
+/* Per-thread state is padded to its own cache line, so threads updating
+   their rng or counters do not invalidate each other's lines. */
+typedef struct
 {
-   pthread_barrier_wait(&barrier);
+   _Alignas(64) rng_t rng;
+} Producer;
+
+typedef struct
+{
+   _Alignas(64) int* counts; /* private histogram of the consumer */
+   long long taken;          /* values it took from the queue */
+} Consumer;
+
+void Ring_init(Ring* ring)
+{
+   atomic_init(&ring->head, 0);
+   atomic_init(&ring->tail, 0);
+   for(size_t i=0; i<QUEUE_SIZE; i++)
+   {
+      atomic_init(&ring->cells[i].sequence, i);
+   }
+}
+
+/* false if the ring is full */
+bool Ring_push(Ring* ring, int bin)
+{
+   size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   Cell* cell;
    while(true)
    {
-      int temp;
-      sem_getvalue(&available_data_count, &temp);
-      if(temp==queue_size)
+      cell = &ring->cells[pos%QUEUE_SIZE];
+      size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+      ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+      if(0 == diff)
       {
-         //printf("Queue is full!\n");
-         continue;
+         if(atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos+1, memory_order_relaxed, memory_order_relaxed))
+         {
+            break;
+         }
       }
+      else if(diff < 0)
+      {
+         return false; /* the cell still holds the value of the previous round */
+      }
+      else
+      {
+         pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+      }
+   }
+   cell->bin = bin;
+   atomic_store_explicit(&cell->sequence, pos+1, memory_order_release);
+   return true;
+}
 
-      float data_val = min_meas + (max_meas - min_meas)*rand_r(seed)/((float) RAND_MAX);
-      if(data_val>=max_meas) // max_meas doesn't belong in the histogram
+/* false if the ring is empty */
+bool Ring_pop(Ring* ring, int* bin)
+{
+   size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   Cell* cell;
+   while(true)
+   {
+      cell = &ring->cells[pos%QUEUE_SIZE];
+      size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+      ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos+1);
+      if(0 == diff)
+      {
+         if(atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos+1, memory_order_relaxed, memory_order_relaxed))
+         {
+            break;
+         }
+      }
+      else if(diff < 0)
+      {
+         return false; /* not filled yet */
+      }
+      else
       {
-         continue;
+         pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
       }
-      int data_index = Which_bin(data_val, bin_maxes, bin_count, min_meas);
+   }
+   *bin = cell->bin;
+   atomic_store_explicit(&cell->sequence, pos+QUEUE_SIZE, memory_order_release);
+   return true;
+}
 
-      pthread_mutex_lock(&pro_mutex);
-      if(sampled_data_count == data_count)
+/* A full or empty ring means waiting for the other side, so the waiting
+   thread gives up its CPU instead of spinning on it. */
+void* producer(void* producer)
+{
+   rng_t* rng = &((Producer*) producer)->rng;
+   pthread_barrier_wait(&barrier);
+   while(atomic_fetch_add_explicit(&sampled_data_count, 1, memory_order_relaxed) < data_count)
+   {
+      float data_val;
+      do // max_meas doesn't belong in the histogram
       {
-         pthread_mutex_unlock(&pro_mutex);
-         break;
+         data_val = min_meas + (max_meas - min_meas)*rng_next_float(rng);
+      } while(data_val>=max_meas);
+      int data_index = bins_find(&bins, data_val);
+      while(!Ring_push(&queue, data_index))
+      {
+         sched_yield();
       }
-      data_index_queue[pro_index] = data_index;
-      pro_index = (pro_index+1)%queue_size;
-      sampled_data_count++;
-      sem_post(&available_data_count);
-      pthread_mutex_unlock(&pro_mutex);
    }
+   atomic_fetch_sub(&producers_left, 1);
    return NULL;
 }
 
-void* consumer(void* useless)
+void* consumer(void* consumer)
 {
+   Consumer* me = (Consumer*) consumer;
+   int* counts = me->counts;
+   long long taken = 0;
    pthread_barrier_wait(&barrier);
    while(true)
    {
-      pthread_mutex_lock(&con_mutex);
-      int temp;
-      sem_getvalue(&available_data_count, &temp);
-      if(temp==0)
+      int target_index;
+      if(Ring_pop(&queue, &target_index))
+      {
+         counts[target_index]++;
+         taken++;
+      }
+      else if(0 == atomic_load(&producers_left))
       {
-         if(sampled_data_count==data_count)
+         /* every push happened before its producer finished */
+         if(!Ring_pop(&queue, &target_index))
          {
-            pthread_mutex_unlock(&con_mutex);
             break;
          }
-         pthread_mutex_unlock(&con_mutex);
-         continue;
+         counts[target_index]++;
+         taken++;
+      }
+      else
+      {
+         sched_yield();
       }
-      sem_wait(&available_data_count);
-      
-      int target_index = data_index_queue[con_index];
-      con_index = (con_index+1)%queue_size;
-      pthread_mutex_unlock(&con_mutex);
-
-      pthread_mutex_lock(&bin_mutexes[target_index]);
-      bin_counts[target_index]++;
-      pthread_mutex_unlock(&bin_mutexes[target_index]);
    }
+   me->taken = taken;
    return NULL;
 }
 
 int main(int argc, char* argv[]) {
    /* Check and get command line args */
-   if (argc != 7) Usage(argv[0]); 
+   if (argc != 7 && argc != 8) Usage(argv[0]); 
    Get_args(argv, &bin_count, &min_meas, &max_meas, &data_count, &pro_count, &con_count);
-   queue_size = 1024;
-   sampled_data_count = pro_index = con_index = 0;
-
-   /* Allocate arrays needed */
-   bin_maxes = malloc(bin_count*sizeof(float));
-   bin_counts = malloc(bin_count*sizeof(int));
-   data_index_queue = malloc(queue_size*sizeof(int));
+   Ring_init(&queue);
+   atomic_init(&sampled_data_count, 0);
+   atomic_init(&producers_left, pro_count);
 
    /* Create bins for storing counts */
-   Gen_bins(min_meas, max_meas, bin_maxes, bin_counts, bin_count);
+   Gen_bins(argv[1], min_meas, max_meas, &bins);
+   bin_count = bins.count;
+   bin_counts = calloc(bin_count+2, sizeof(int));
    
-   pthread_mutex_init(&pro_mutex, NULL);
-   pthread_mutex_init(&con_mutex, NULL);
-   bin_mutexes = malloc(bin_count*sizeof(pthread_mutex_t));
-   for(int i=0; i<bin_count; i++)
-   {
-      pthread_mutex_init(&bin_mutexes[i], NULL);
-   }
    pthread_barrier_init(&barrier, NULL, pro_count+con_count);
-   sem_init(&available_data_count, 0, 0);
    pthread_t* pro_handles = malloc(pro_count*sizeof(pthread_t));
-   unsigned int* seeds = malloc(pro_count*sizeof(unsigned int));
+   unsigned long long seed = (8 == argc) ? strtoull(argv[7], NULL, 10) : rng_time_seed();
+   Producer* producers = aligned_alloc(64, pro_count*sizeof(Producer));
 
-   double begin;
+   double begin = 0;
    for (int i = 0; i < pro_count; i++)
    {
-      seeds[i] = time(NULL)*(i+1);
-      pthread_create(&pro_handles[i], NULL, producer, (void*) &seeds[i]);
+      rng_init(&producers[i].rng, seed, i);
+      pthread_create(&pro_handles[i], NULL, producer, (void*) &producers[i]);
    }
    pthread_t* con_handles = malloc(con_count*sizeof(pthread_t));
+   Consumer* consumers = aligned_alloc(64, con_count*sizeof(Consumer));
+   size_t counts_bytes = ((bin_count+2)*sizeof(int) + 63)/64*64;
    for (int i = 0; i < con_count; i++)
    {
+      consumers[i].counts = aligned_alloc(64, counts_bytes);
+      memset(consumers[i].counts, 0, counts_bytes);
+      consumers[i].taken = 0;
       if(i==con_count-1)
       {
          begin = elapsed_seconds();
       }
-      pthread_create(&con_handles[i], NULL, consumer, NULL);
+      pthread_create(&con_handles[i], NULL, consumer, (void*) &consumers[i]);
    }
    for(int i=0; i<pro_count; i++)
    {
@@ -193,26 +277,30 @@ int main(int argc, char* argv[]) {
    }
    double end = elapsed_seconds();
 
-   sem_destroy(&available_data_count);
-   pthread_barrier_destroy(&barrier);
-   pthread_mutex_destroy(&pro_mutex);
-   pthread_mutex_destroy(&con_mutex);
-   for(int i=0; i<bin_count; i++)
+   long long taken = 0;
+   for(int i=0; i<con_count; i++)
    {
-      pthread_mutex_destroy(&bin_mutexes[i]);
+      for(int j=0; j<bin_count+2; j++)
+      {
+         bin_counts[j] += consumers[i].counts[j];
+      }
+      taken += consumers[i].taken;
+      free(consumers[i].counts);
    }
-   free(bin_mutexes);
+   pthread_barrier_destroy(&barrier);
+   free(consumers);
    free(pro_handles);
-   free(seeds);
+   free(producers);
    free(con_handles);
    
 
    /* Print the histogram */
-   Print_histo(bin_maxes, bin_counts, bin_count, min_meas);
+   Print_histo(bins.maxes, bin_counts, bin_count, bins.min);
    printf("Time Taken: %f\n", end-begin);
-   printf("Sampled points: %d\n", sampled_data_count);
-   free(data_index_queue);
-   free(bin_maxes);
+   printf("Seed: %llu\n", seed);
+   printf("Sampled points: %lld\n", taken);
+   printf("Items per second: %.0f\n", taken/(end-begin));
+   bins_free(&bins);
    free(bin_counts);
    return 0;
 
@@ -234,7 +322,7 @@ double elapsed_seconds()
  */
 void Usage(char prog_name[] /* in */) {
    fprintf(stderr, "usage: %s ", prog_name); 
-   fprintf(stderr, "<bin_count> <min_meas> <max_meas> <data_count> <pro_count> <con_count>\n");
+   fprintf(stderr, "<bin_count|edge_file> <min_meas> <max_meas> <data_count> <pro_count> <con_count> [seed]\n");
    exit(0);
 }  /* Usage */
 
@@ -273,83 +361,30 @@ void Get_args(
 
 /*---------------------------------------------------------------------
  * Function:  Gen_bins
- * Purpose:   Compute max value for each bin, and store 0 as the
- *            number of values in each bin
- * In args:   min_meas:   the minimum possible measurement
+ * Purpose:   Compute the edges of the bins: bin_arg equal bins from
+ *            min_meas to max_meas, or the edges in the file bin_arg
+ * In args:   bin_arg:    the <bin_count> argument
+ *            min_meas:   the minimum possible measurement
  *            max_meas:   the maximum possible measurement
- *            bin_count:  the number of bins
- * Out args:  bin_maxes:  the maximum possible value for each bin
- *            bin_counts: the number of data values in each bin
+ * Out arg:   bins:       the edges of the bins, see ../common/bins.h
  */
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */) {
-   float bin_width;
-   int   i;
-
-   bin_width = (max_meas - min_meas)/bin_count;
-
-   for (i = 0; i < bin_count; i++) {
-      bin_maxes[i] = min_meas + (i+1)*bin_width;
-      bin_counts[i] = 0;
-   }
+      bins_t* bins        /* out */) {
+   if (0 != bins_parse(bins, bin_arg, min_meas, max_meas))
+      exit(-1);
 
 #  ifdef DEBUG
    printf("bin_maxes = ");
-   for (i = 0; i < bin_count; i++)
-      printf("%4.3f ", bin_maxes[i]);
+   for (int i = 0; i < bins->count; i++)
+      printf("%4.3f ", bins->maxes[i]);
    printf("\n");
 #  endif
 }  /* Gen_bins */
 
 
-/*---------------------------------------------------------------------
- * Function:  Which_bin
- * Purpose:   Use binary search to determine which bin a measurement 
- *            belongs to
- * In args:   data:       the current measurement
- *            bin_maxes:  list of max bin values
- *            bin_count:  number of bins
- *            min_meas:   the minimum possible measurement
- * Return:    the number of the bin to which data belongs
- * Notes:      
- * 1.  The bin to which data belongs satisfies
- *
- *            bin_maxes[i-1] <= data < bin_maxes[i] 
- *
- *     where, bin_maxes[-1] = min_meas
- * 2.  If the search fails, the function prints a message and exits
- */
-int Which_bin(
-      float   data          /* in */, 
-      float   bin_maxes[]   /* in */, 
-      int     bin_count     /* in */, 
-      float   min_meas      /* in */) {
-   int bottom = 0, top = bin_count-1;
-   int mid;
-   float bin_max, bin_min;
-
-   while (bottom <= top) {
-      mid = (bottom + top)/2;
-      bin_max = bin_maxes[mid];
-      bin_min = (mid == 0) ? min_meas: bin_maxes[mid-1];
-      if (data >= bin_max) 
-         bottom = mid+1;
-      else if (data < bin_min)
-         top = mid-1;
-      else
-         return mid;
-   }
-   /* Whoops! */
-   fprintf(stderr, "Data = %f doesn't belong to a bin!\n", data);
-   fprintf(stderr, "Quitting\n");
-   exit(-1);
-}  /* Which_bin */
-
-
 /*---------------------------------------------------------------------
  * Function:  Print_histo
  * Purpose:   Print a histogram.  The number of elements in each
@@ -375,10 +410,14 @@ void Print_histo(
       sampled_data_count += bin_counts[i];
       largest_bin_count = largest_bin_count<bin_counts[i] ? bin_counts[i] : largest_bin_count;
    }
-   for(i=0; i<bin_count; i++)
+   // an edge file may put every value outside the bins
+   if(0 < largest_bin_count)
    {
-      double ratio = (double) bin_counts[i] / (double) largest_bin_count;
-      bin_counts[i] = round((double)normal_factor*ratio);
+      for(i=0; i<bin_count; i++)
+      {
+         double ratio = (double) bin_counts[i] / (double) largest_bin_count;
+         bin_counts[i] = round((double)normal_factor*ratio);
+      }
    }
    
    for (i = 0; i < bin_count; i++) {
@@ -389,4 +428,7 @@ void Print_histo(
          printf("X");
       printf("\n");
    }
+   if (bin_counts[bin_count] > 0 || bin_counts[bin_count+1] > 0)
+      printf("Below %.3f: %d, at or above %.3f: %d\n", min_meas, bin_counts[bin_count],
+            bin_maxes[bin_count-1], bin_counts[bin_count+1]);
 }  /* Print_histo */
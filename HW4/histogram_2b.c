@@ -13,9 +13,9 @@
  * 2.  bin_counts[i] stores the number of measurements x in the range
  * 3.  bin_maxes[i-1] <= x < bin_maxes[i] (bin_maxes[-1] = min_meas)
  * 4.  DEBUG compile flag gives verbose output
- * 5.  The program will terminate if either the number of command line
- *     arguments is incorrect or if the search for a bin for a 
- *     measurement fails.
+ * 5.  The program will terminate if the number of command line
+ *     arguments is incorrect. Measurements outside the bins are
+ *     counted in an underflow and an overflow bin (../common/bins.h).
  *
  * IPP:  Section 2.7.1 (pp. 66 and ff.)
  */
@@ -25,6 +25,8 @@
 #include <math.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include "rng.h"
+#include "bins.h"
 #include <semaphore.h>
 
 void Usage(char prog_name[]);
@@ -39,17 +41,10 @@ void Get_args(
       int*     thread_count  /* out */);
 
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */);
-
-int Which_bin(
-      float    data         /* in */, 
-      float    bin_maxes[]  /* in */, 
-      int      bin_count    /* in */, 
-      float    min_meas     /* in */);
+      bins_t* bins        /* out */);
 
 void Print_histo(
       float    bin_maxes[]   /* in */, 
@@ -60,7 +55,7 @@ void Print_histo(
 
 int bin_count;
 float min_meas, max_meas;
-float* bin_maxes;
+bins_t bins;
 int* bin_counts;
 int data_count;
 int thread_count;
@@ -68,18 +63,18 @@ pthread_mutex_t* bin_mutexes;
 int sampled_data_count;
 pthread_barrier_t barrier;
 
-void* gen_and_assign(void* seed)
+void* gen_and_assign(void* rng)
 {
    pthread_barrier_wait(&barrier);
    for(int i=0; i<data_count; i++)
    {
-      float data_val = min_meas + (max_meas - min_meas)*rand_r(seed)/((float) RAND_MAX);
+      float data_val = min_meas + (max_meas - min_meas)*rng_next_float(rng);
       if(data_val>=max_meas) // max_meas doesn't belong in the histogram
       {
          i--;
          continue;
       }
-      int data_index = Which_bin(data_val, bin_maxes, bin_count, min_meas);
+      int data_index = bins_find(&bins, data_val);
 
       pthread_mutex_lock(&bin_mutexes[data_index]);
       bin_counts[data_index]++;
@@ -91,36 +86,37 @@ void* gen_and_assign(void* seed)
 
 int main(int argc, char* argv[]) {
    /* Check and get command line args */
-   if (argc != 6) Usage(argv[0]); 
+   if (argc != 6 && argc != 7) Usage(argv[0]); 
    Get_args(argv, &bin_count, &min_meas, &max_meas, &data_count, &thread_count);
    sampled_data_count = 0;
    data_count /= thread_count;
 
    /* Allocate arrays needed */
-   bin_maxes = malloc(bin_count*sizeof(float));
-   bin_counts = malloc(bin_count*sizeof(int));
 
    /* Create bins for storing counts */
-   Gen_bins(min_meas, max_meas, bin_maxes, bin_counts, bin_count);
+   Gen_bins(argv[1], min_meas, max_meas, &bins);
+   bin_count = bins.count;
+   bin_counts = calloc(bin_count+2, sizeof(int));
    
-   bin_mutexes = malloc(bin_count*sizeof(pthread_mutex_t));
+   bin_mutexes = malloc((bin_count+2)*sizeof(pthread_mutex_t));
    pthread_barrier_init(&barrier, NULL, thread_count);
-   for(int i=0; i<bin_count; i++)
+   for(int i=0; i<bin_count+2; i++)
    {
       pthread_mutex_init(&bin_mutexes[i], NULL);
    }
    pthread_t* thread_handles = malloc(thread_count*sizeof(pthread_t));
-   unsigned int* seeds = malloc(thread_count*sizeof(unsigned int));
+   unsigned long long seed = (7 == argc) ? strtoull(argv[6], NULL, 10) : rng_time_seed();
+   rng_t* rngs = malloc(thread_count*sizeof(rng_t));
 
-   double begin;
+   double begin = 0;
    for (int i = 0; i < thread_count; i++)
    {
-      seeds[i] = time(NULL)*(i+1);
+      rng_init(&rngs[i], seed, i);
       if(i == thread_count-1)
       {
          begin = elapsed_seconds();
       }
-      pthread_create(&thread_handles[i], NULL, gen_and_assign, (void*) &seeds[i]);
+      pthread_create(&thread_handles[i], NULL, gen_and_assign, (void*) &rngs[i]);
    }
    for(int i=0; i<thread_count; i++)
    {
@@ -129,20 +125,21 @@ int main(int argc, char* argv[]) {
    double end = elapsed_seconds();
 
    pthread_barrier_destroy(&barrier);
-   for(int i=0; i<bin_count; i++)
+   for(int i=0; i<bin_count+2; i++)
    {
       pthread_mutex_destroy(&bin_mutexes[i]);
    }
    free(bin_mutexes);
    free(thread_handles);
-   free(seeds);
+   free(rngs);
    
 
    /* Print the histogram */
-   Print_histo(bin_maxes, bin_counts, bin_count, min_meas);
+   Print_histo(bins.maxes, bin_counts, bin_count, bins.min);
    printf("Time Taken: %f\n", end-begin);
+   printf("Seed: %llu\n", seed);
    printf("Sampled points: %d\n", sampled_data_count);
-   free(bin_maxes);
+   bins_free(&bins);
    free(bin_counts);
    return 0;
 
@@ -164,7 +161,7 @@ double elapsed_seconds()
  */
 void Usage(char prog_name[] /* in */) {
    fprintf(stderr, "usage: %s ", prog_name); 
-   fprintf(stderr, "<bin_count> <min_meas> <max_meas> <data_count> <thread_count>\n");
+   fprintf(stderr, "<bin_count|edge_file> <min_meas> <max_meas> <data_count> <thread_count> [seed]\n");
    exit(0);
 }  /* Usage */
 
@@ -201,83 +198,30 @@ void Get_args(
 
 /*---------------------------------------------------------------------
  * Function:  Gen_bins
- * Purpose:   Compute max value for each bin, and store 0 as the
- *            number of values in each bin
- * In args:   min_meas:   the minimum possible measurement
+ * Purpose:   Compute the edges of the bins: bin_arg equal bins from
+ *            min_meas to max_meas, or the edges in the file bin_arg
+ * In args:   bin_arg:    the <bin_count> argument
+ *            min_meas:   the minimum possible measurement
  *            max_meas:   the maximum possible measurement
- *            bin_count:  the number of bins
- * Out args:  bin_maxes:  the maximum possible value for each bin
- *            bin_counts: the number of data values in each bin
+ * Out arg:   bins:       the edges of the bins, see ../common/bins.h
  */
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */) {
-   float bin_width;
-   int   i;
-
-   bin_width = (max_meas - min_meas)/bin_count;
-
-   for (i = 0; i < bin_count; i++) {
-      bin_maxes[i] = min_meas + (i+1)*bin_width;
-      bin_counts[i] = 0;
-   }
+      bins_t* bins        /* out */) {
+   if (0 != bins_parse(bins, bin_arg, min_meas, max_meas))
+      exit(-1);
 
 #  ifdef DEBUG
    printf("bin_maxes = ");
-   for (i = 0; i < bin_count; i++)
-      printf("%4.3f ", bin_maxes[i]);
+   for (int i = 0; i < bins->count; i++)
+      printf("%4.3f ", bins->maxes[i]);
    printf("\n");
 #  endif
 }  /* Gen_bins */
 
 
-/*---------------------------------------------------------------------
- * Function:  Which_bin
- * Purpose:   Use binary search to determine which bin a measurement 
- *            belongs to
- * In args:   data:       the current measurement
- *            bin_maxes:  list of max bin values
- *            bin_count:  number of bins
- *            min_meas:   the minimum possible measurement
- * Return:    the number of the bin to which data belongs
- * Notes:      
- * 1.  The bin to which data belongs satisfies
- *
- *            bin_maxes[i-1] <= data < bin_maxes[i] 
- *
- *     where, bin_maxes[-1] = min_meas
- * 2.  If the search fails, the function prints a message and exits
- */
-int Which_bin(
-      float   data          /* in */, 
-      float   bin_maxes[]   /* in */, 
-      int     bin_count     /* in */, 
-      float   min_meas      /* in */) {
-   int bottom = 0, top = bin_count-1;
-   int mid;
-   float bin_max, bin_min;
-
-   while (bottom <= top) {
-      mid = (bottom + top)/2;
-      bin_max = bin_maxes[mid];
-      bin_min = (mid == 0) ? min_meas: bin_maxes[mid-1];
-      if (data >= bin_max) 
-         bottom = mid+1;
-      else if (data < bin_min)
-         top = mid-1;
-      else
-         return mid;
-   }
-   /* Whoops! */
-   fprintf(stderr, "Data = %f doesn't belong to a bin!\n", data);
-   fprintf(stderr, "Quitting\n");
-   exit(-1);
-}  /* Which_bin */
-
-
 /*---------------------------------------------------------------------
  * Function:  Print_histo
  * Purpose:   Print a histogram.  The number of elements in each
@@ -303,10 +247,14 @@ void Print_histo(
       sampled_data_count += bin_counts[i];
       largest_bin_count = largest_bin_count<bin_counts[i] ? bin_counts[i] : largest_bin_count;
    }
-   for(i=0; i<bin_count; i++)
+   // an edge file may put every value outside the bins
+   if(0 < largest_bin_count)
    {
-      double ratio = (double) bin_counts[i] / (double) largest_bin_count;
-      bin_counts[i] = round((double)normal_factor*ratio);
+      for(i=0; i<bin_count; i++)
+      {
+         double ratio = (double) bin_counts[i] / (double) largest_bin_count;
+         bin_counts[i] = round((double)normal_factor*ratio);
+      }
    }
    
    for (i = 0; i < bin_count; i++) {
@@ -317,4 +265,7 @@ void Print_histo(
          printf("X");
       printf("\n");
    }
+   if (bin_counts[bin_count] > 0 || bin_counts[bin_count+1] > 0)
+      printf("Below %.3f: %d, at or above %.3f: %d\n", min_meas, bin_counts[bin_count],
+            bin_maxes[bin_count-1], bin_counts[bin_count+1]);
 }  /* Print_histo */
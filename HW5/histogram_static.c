@@ -4,6 +4,13 @@
 #include <time.h>
 #include <sys/time.h>
 #include <omp.h>
+#include "rng.h"
+#include "bins.h"
+
+/* measurements generated from one random stream, see Gen_data */
+#define GEN_CHUNK 65536
+/* measurements scheduled together and counted by one call of bins_count */
+#define COUNT_CHUNK 256
 
 double elapsed_seconds();
 void Usage(char prog_name[]);
@@ -20,20 +27,15 @@ void Gen_data(
       float   min_meas    /* in  */, 
       float   max_meas    /* in  */, 
       float   data[]      /* out */,
-      int     data_count  /* in  */);
+      int     data_count  /* in  */,
+      unsigned long long seed /* in */,
+      int     thread_count /* in */);
 
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */);
-
-int Which_bin(
-      float    data         /* in */, 
-      float    bin_maxes[]  /* in */, 
-      int      bin_count    /* in */, 
-      float    min_meas     /* in */);
+      bins_t* bins        /* out */);
 
 void Print_histo(
       float    bin_maxes[]   /* in */, 
@@ -42,33 +44,38 @@ void Print_histo(
       float    min_meas      /* in */);
 
 int main(int argc, char* argv[]) {
-   int bin_count, i, bin;
+   int bin_count, i;
    float min_meas, max_meas;
-   float* bin_maxes;
+   bins_t bins;
    int* bin_counts;
    int data_count;
    float* data;
    int thread_count;
+   unsigned long long seed;
 
    /* Check and get command line args */
-   if (argc != 6) Usage(argv[0]); 
+   if (argc != 6 && argc != 7) Usage(argv[0]); 
    Get_args(argv, &bin_count, &min_meas, &max_meas, &data_count, &thread_count);
+   seed = (7 == argc) ? strtoull(argv[6], NULL, 10) : rng_time_seed();
 
    /* Allocate arrays needed */
-   bin_maxes = malloc(bin_count*sizeof(float));
-   bin_counts = malloc(bin_count*sizeof(int));
    data = malloc(data_count*sizeof(float));
 
    /* Generate the data */
-   Gen_data(min_meas, max_meas, data, data_count);
+   Gen_data(min_meas, max_meas, data, data_count, seed, thread_count);
 
    /* Create bins for storing counts */
-   Gen_bins(min_meas, max_meas, bin_maxes, bin_counts, bin_count);
+   Gen_bins(argv[1], min_meas, max_meas, &bins);
+   bin_count = bins.count;
+   bin_counts = calloc(bin_count+2, sizeof(int));
 
-   /* Count number of values in each bin */
+   /* Count number of values in each bin: every thread counts its chunks
+      into its own sub-histograms with the SIMD kernel of ../common/bins.c
+      and adds them to bin_counts at the end */
    double begin;
    #pragma omp parallel num_threads(thread_count)
    {
+      int* sub = bins_subcounts(&bins);
       if(0 == omp_get_thread_num())
       {
          printf("Number of threads started: %d\n", omp_get_num_threads());
@@ -76,21 +83,22 @@ int main(int argc, char* argv[]) {
       # pragma omp barrier
       
       begin = elapsed_seconds();
-      #pragma omp for schedule(static, 256) private(i, bin)
-      for (i = 0; i < data_count; i++) {
-         bin = Which_bin(data[i], bin_maxes, bin_count, min_meas);
-         #pragma omp atomic
-         bin_counts[bin]++;
+      #pragma omp for schedule(static, 1) private(i)
+      for (i = 0; i < data_count; i += COUNT_CHUNK) {
+         bins_count(&bins, data+i, data_count-i < COUNT_CHUNK ? data_count-i : COUNT_CHUNK, sub);
       }
+      #pragma omp critical
+      bins_fold(&bins, sub, bin_counts);
    }
    double end = elapsed_seconds();
 
    /* Print the histogram */
-   Print_histo(bin_maxes, bin_counts, bin_count, min_meas);
+   Print_histo(bins.maxes, bin_counts, bin_count, bins.min);
    printf("Time taken (s): %f\n", end-begin);
+   printf("Seed: %llu\n", seed);
 
    free(data);
-   free(bin_maxes);
+   bins_free(&bins);
    free(bin_counts);
    return 0;
 
@@ -104,7 +112,7 @@ int main(int argc, char* argv[]) {
  */
 void Usage(char prog_name[] /* in */) {
    fprintf(stderr, "usage: %s ", prog_name); 
-   fprintf(stderr, "<bin_count> <min_meas> <max_meas> <data_count> <thread_count>\n");
+   fprintf(stderr, "<bin_count|edge_file> <min_meas> <max_meas> <data_count> <thread_count> [seed]\n");
    exit(0);
 }  /* Usage */
 
@@ -137,25 +145,41 @@ void Get_args(
 /*---------------------------------------------------------------------
  * Function:  Gen_data
  * Purpose:   Generate random floats in the range min_meas <= x < max_meas
- * In args:   min_meas:    the minimum possible value for the data
- *            max_meas:    the maximum possible value for the data
- *            data_count:  the number of measurements
- * Out arg:   data:        the actual measurements
+ * In args:   min_meas:     the minimum possible value for the data
+ *            max_meas:     the maximum possible value for the data
+ *            data_count:   the number of measurements
+ *            seed:         seed of the random number generator
+ *            thread_count: number of threads generating the data
+ * Out arg:   data:         the actual measurements
+ * Note:      Chunk c of GEN_CHUNK measurements always comes from stream c
+ *            of the seed, so the data doesn't depend on thread_count.
  */
 void Gen_data(
         float   min_meas    /* in  */, 
         float   max_meas    /* in  */, 
         float   data[]      /* out */,
-        int     data_count  /* in  */) {
-   int i;
-
-   srandom(time(NULL));
-   for (i = 0; i < data_count; i++)
+        int     data_count  /* in  */,
+        unsigned long long seed /* in */,
+        int     thread_count /* in */) {
+   int c, i;
+   int chunk_count = (data_count + GEN_CHUNK - 1)/GEN_CHUNK;
+
+   #pragma omp parallel for num_threads(thread_count) schedule(static) private(i)
+   for (c = 0; c < chunk_count; c++)
    {
-      data[i] = min_meas + (max_meas - min_meas)*random()/((double) RAND_MAX);
-      if(data[i]>=max_meas)
+      rng_t rng;
+      int start = c*GEN_CHUNK;
+      int end = data_count-start < GEN_CHUNK ? data_count : start+GEN_CHUNK;
+
+      rng_init(&rng, seed, c);
+      rng_fill_float(&rng, data+start, end-start);
+      for (i = start; i < end; i++)
       {
-         i--;
+         data[i] = min_meas + (max_meas - min_meas)*data[i];
+         while(data[i]>=max_meas)
+         {
+            data[i] = min_meas + (max_meas - min_meas)*rng_next_float(&rng);
+         }
       }
    }
       
@@ -164,77 +188,23 @@ void Gen_data(
 
 /*---------------------------------------------------------------------
  * Function:  Gen_bins
- * Purpose:   Compute max value for each bin, and store 0 as the
- *            number of values in each bin
- * In args:   min_meas:   the minimum possible measurement
+ * Purpose:   Compute the edges of the bins: bin_arg equal bins from
+ *            min_meas to max_meas, or the edges in the file bin_arg
+ * In args:   bin_arg:    the <bin_count> argument
+ *            min_meas:   the minimum possible measurement
  *            max_meas:   the maximum possible measurement
- *            bin_count:  the number of bins
- * Out args:  bin_maxes:  the maximum possible value for each bin
- *            bin_counts: the number of data values in each bin
+ * Out arg:   bins:       the edges of the bins, see ../common/bins.h
  */
 void Gen_bins(
+      char  bin_arg[]     /* in  */,
       float min_meas      /* in  */, 
       float max_meas      /* in  */, 
-      float bin_maxes[]   /* out */, 
-      int   bin_counts[]  /* out */, 
-      int   bin_count     /* in  */) {
-   float bin_width;
-   int   i;
-
-   bin_width = (max_meas - min_meas)/bin_count;
-
-   for (i = 0; i < bin_count; i++) {
-      bin_maxes[i] = min_meas + (i+1)*bin_width;
-      bin_counts[i] = 0;
-   }
+      bins_t* bins        /* out */) {
+   if (0 != bins_parse(bins, bin_arg, min_meas, max_meas))
+      exit(-1);
 }  /* Gen_bins */
 
 
-/*---------------------------------------------------------------------
- * Function:  Which_bin
- * Purpose:   Use binary search to determine which bin a measurement 
- *            belongs to
- * In args:   data:       the current measurement
- *            bin_maxes:  list of max bin values
- *            bin_count:  number of bins
- *            min_meas:   the minimum possible measurement
- * Return:    the number of the bin to which data belongs
- * Notes:      
- * 1.  The bin to which data belongs satisfies
- *
- *            bin_maxes[i-1] <= data < bin_maxes[i] 
- *
- *     where, bin_maxes[-1] = min_meas
- * 2.  If the search fails, the function prints a message and exits
- */
-int Which_bin(
-      float   data          /* in */, 
-      float   bin_maxes[]   /* in */, 
-      int     bin_count     /* in */, 
-      float   min_meas      /* in */) {
-   int bottom = 0, top =  bin_count-1;
-   int mid;
-   float bin_max, bin_min;
-
-   while (bottom <= top) {
-      mid = (bottom + top)/2;
-      bin_max = bin_maxes[mid];
-      bin_min = (mid == 0) ? min_meas: bin_maxes[mid-1];
-      if (data >= bin_max) 
-         bottom = mid+1;
-      else if (data < bin_min)
-         top = mid-1;
-      else
-         return mid;
-   }
-
-   /* Whoops! */
-   fprintf(stderr, "Data = %f doesn't belong to a bin!\n", data);
-   fprintf(stderr, "Quitting\n");
-   exit(-1);
-}  /* Which_bin */
-
-
 /*---------------------------------------------------------------------
  * Function:  Print_histo
  * Purpose:   Print a histogram.  The number of elements in each
@@ -258,10 +228,14 @@ void Print_histo(
    {
       largest_bin_count = largest_bin_count<bin_counts[i] ? bin_counts[i] : largest_bin_count;
    }
-   for(i=0; i<bin_count; i++)
+   // an edge file may put every value outside the bins
+   if(0 < largest_bin_count)
    {
-      double ratio = (double) bin_counts[i] / (double) largest_bin_count;
-      bin_counts[i] = round((double)normal_factor*ratio);
+      for(i=0; i<bin_count; i++)
+      {
+         double ratio = (double) bin_counts[i] / (double) largest_bin_count;
+         bin_counts[i] = round((double)normal_factor*ratio);
+      }
    }
 
    for (i = 0; i < bin_count; i++) {
@@ -272,6 +246,9 @@ void Print_histo(
          printf("X");
       printf("\n");
    }
+   if (bin_counts[bin_count] > 0 || bin_counts[bin_count+1] > 0)
+      printf("Below %.3f: %d, at or above %.3f: %d\n", min_meas, bin_counts[bin_count],
+            bin_maxes[bin_count-1], bin_counts[bin_count+1]);
 }  /* Print_histo */
 
 double elapsed_seconds()
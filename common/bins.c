@@ -0,0 +1,350 @@
+/**
+ * bins.c:
+ *
+ * Edges of the histogram bins and the search for non-uniform ones.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bins.h"
+
+// every 16 floats of the tree share a cache line; 16k..16k+15 are the
+// descendants of k four levels down
+#define TREE_LINE 16
+
+void bins_uniform(bins_t *bins, float min, float max, int count)
+{
+  float width = (max - min)/count;
+  bins->count = count;
+  bins->min = min;
+  bins->maxes = malloc(count*sizeof(float));
+  for (int i = 0; i < count; i++)
+    bins->maxes[i] = min + (i+1)*width;
+  bins->method = BINS_ARITHMETIC;
+  bins->inv_width = count/(max - min);
+  bins->tree = NULL;
+  bins->tree_bin = NULL;
+}
+
+// fills tree[k] and its subtree in order with maxes[i], maxes[i+1], ...,
+// returns the next i
+static int eytzinger_fill(bins_t *bins, int i, int k)
+{
+  if (k <= bins->count) {
+    i = eytzinger_fill(bins, i, 2*k);
+    bins->tree[k] = bins->maxes[i];
+    bins->tree_bin[k] = i;
+    i = eytzinger_fill(bins, i+1, 2*k+1);
+  }
+  return i;
+}
+
+void bins_edges(bins_t *bins, float min, const float *maxes, int count)
+{
+  bins->count = count;
+  bins->min = min;
+  bins->maxes = malloc(count*sizeof(float));
+  memcpy(bins->maxes, maxes, count*sizeof(float));
+  bins->inv_width = 0;
+  bins->tree_bin = NULL;
+  if (count <= BINS_LINEAR_MAX) {
+    int padded = (count+7)/8*8;
+    bins->method = BINS_LINEAR;
+    bins->tree = aligned_alloc(32, padded*sizeof(float));
+    for (int i = 0; i < padded; i++)
+      bins->tree[i] = i < count ? maxes[i] : INFINITY;
+  }
+  else {
+    size_t bytes = ((count+1)*sizeof(float) + 63)/64*64;
+    bins->method = BINS_EYTZINGER;
+    bins->tree = aligned_alloc(64, bytes);
+    bins->tree_bin = malloc((count+1)*sizeof(int));
+    eytzinger_fill(bins, 0, 1);
+  }
+}
+
+int bins_read(bins_t *bins, const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open the edge file %s\n", path);
+    return -1;
+  }
+  int n = 0, capacity = 1024;
+  float *edges = malloc(capacity*sizeof(float));
+  float edge;
+  while (fscanf(file, "%f", &edge) == 1) {
+    if (n == capacity) {
+      capacity *= 2;
+      edges = realloc(edges, capacity*sizeof(float));
+    }
+    edges[n++] = edge;
+  }
+  int bad = !feof(file);
+  fclose(file);
+  for (int i = 1; i < n && !bad; i++)
+    bad = !(edges[i-1] <= edges[i]);
+  if (bad || n < 2) {
+    fprintf(stderr, "%s must hold at least two nondecreasing numbers\n", path);
+    free(edges);
+    return -1;
+  }
+  bins_edges(bins, edges[0], edges+1, n-1);
+  free(edges);
+  return 0;
+}
+
+int bins_parse(bins_t *bins, const char *arg, float min, float max)
+{
+  char *end;
+  long count = strtol(arg, &end, 10);
+  if (*end == 0 && end != arg) {
+    if (count < 1 || !(min < max)) {
+      fprintf(stderr, "Need at least one bin and min < max\n");
+      return -1;
+    }
+    bins_uniform(bins, min, max, count);
+    return 0;
+  }
+  return bins_read(bins, arg);
+}
+
+void bins_free(bins_t *bins)
+{
+  free(bins->maxes);
+  free(bins->tree);
+  free(bins->tree_bin);
+  bins->maxes = NULL;
+  bins->tree = NULL;
+  bins->tree_bin = NULL;
+}
+
+// The first k with x < tree[k] in order: the search goes right while
+// tree[k] <= x, so the answer is the last node where it went left. Shifting
+// out the trailing right turns (ones) and that left turn gives it.
+static int eytzinger_search(const bins_t *bins, float x)
+{
+  const float *tree = bins->tree;
+  int k = 1;
+  while (k <= bins->count) {
+    __builtin_prefetch(tree + TREE_LINE*k);
+    k = 2*k + (tree[k] <= x);
+  }
+  k >>= __builtin_ffs(~k);
+  return bins->tree_bin[k];
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// the bin of x is the number of upper edges <= x
+static int linear_search_sse2(const bins_t *bins, float x)
+{
+  __m128 v = _mm_set1_ps(x);
+  int n = 0;
+  for (int i = 0; i < bins->count; i += 4)
+    n += __builtin_popcount(_mm_movemask_ps(_mm_cmple_ps(_mm_load_ps(bins->tree + i), v)));
+  return n;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int linear_search_avx2(const bins_t *bins, float x)
+{
+  __m256 v = _mm256_set1_ps(x);
+  int n = 0;
+  for (int i = 0; i < bins->count; i += 8)
+    n += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(bins->tree + i), v, _CMP_LE_OQ)));
+  return n;
+}
+
+static int linear_search(const bins_t *bins, float x)
+{
+  static int isa = -1;  // 1 = AVX2, 0 = SSE2
+  if (isa < 0)
+    isa = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  return isa ? linear_search_avx2(bins, x) : linear_search_sse2(bins, x);
+}
+#else
+static int linear_search(const bins_t *bins, float x)
+{
+  int n = 0;
+  for (int i = 0; i < bins->count; i++)
+    n += bins->tree[i] <= x;
+  return n;
+}
+#endif
+
+// the bin of x for min <= x < maxes[count-1]
+int bins_search(const bins_t *bins, float x)
+{
+  if (bins->method == BINS_LINEAR)
+    return linear_search(bins, x);
+  return eytzinger_search(bins, x);
+}
+
+// the kernel bins_count uses on this CPU: 2 = AVX-512, 1 = AVX2, 0 = scalar
+static int count_isa(void)
+{
+#if defined(__x86_64__)
+  static int isa = -1;
+  if (isa < 0)
+    isa = __builtin_cpu_supports("avx512f") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+  return isa;
+#else
+  return 0;
+#endif
+}
+
+// sub-histograms per bin, see BINS_LANES; the scalar path (no AVX2 or
+// Eytzinger edges) and more than BINS_SUB_MAX bins count into one histogram
+static int sub_lanes(const bins_t *bins)
+{
+  if (bins->method == BINS_EYTZINGER || bins->count+2 > BINS_SUB_MAX || count_isa() == 0)
+    return 1;
+  return BINS_LANES;
+}
+
+int *bins_subcounts(const bins_t *bins)
+{
+  return calloc((size_t)(bins->count+2)*sub_lanes(bins), sizeof(int));
+}
+
+void bins_fold(const bins_t *bins, int *sub, int *counts)
+{
+  int lanes = sub_lanes(bins);
+  for (int b = 0; b < bins->count+2; b++)
+    for (int l = 0; l < lanes; l++)
+      counts[b] += sub[b*lanes + l];
+  free(sub);
+}
+
+static void count_scalar(const bins_t *bins, const float *data, long long n, int *sub)
+{
+  int lanes = sub_lanes(bins);
+  for (long long i = 0; i < n; i++)
+    sub[bins_find(bins, data[i])*lanes + (i & (lanes-1))]++;
+}
+
+#if defined(__x86_64__)
+// The bins of 8 values, in lanes 0..7 of the result. Lanes whose uniform
+// estimate is off by one (close to an edge) are set in *fix and must be
+// found with bins_find.
+__attribute__((target("avx2")))
+static __m256i find_avx2(const bins_t *bins, __m256 v, int *fix)
+{
+  int last = bins->count-1;
+  __m256 min = _mm256_set1_ps(bins->min);
+  __m256i b;
+  *fix = 0;
+  if (bins->method == BINS_ARITHMETIC) {
+    __m256 t = _mm256_mul_ps(_mm256_sub_ps(v, min), _mm256_set1_ps(bins->inv_width));
+    // NaNs and out-of-range values convert to INT_MIN and are replaced below
+    b = _mm256_cvttps_epi32(t);
+    b = _mm256_min_epi32(_mm256_max_epi32(b, _mm256_setzero_si256()), _mm256_set1_epi32(last));
+    __m256i below = _mm256_max_epi32(_mm256_sub_epi32(b, _mm256_set1_epi32(1)), _mm256_setzero_si256());
+    __m256 lo = _mm256_i32gather_ps(bins->maxes, below, 4);
+    lo = _mm256_blendv_ps(lo, min, _mm256_castsi256_ps(_mm256_cmpeq_epi32(b, _mm256_setzero_si256())));
+    __m256 hi = _mm256_i32gather_ps(bins->maxes, b, 4);
+    *fix = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(v, lo, _CMP_LT_OQ), _mm256_cmp_ps(v, hi, _CMP_GE_OQ)));
+  }
+  else {
+    // the number of edges at or below v
+    b = _mm256_setzero_si256();
+    for (int e = 0; e < bins->count; e++)
+      b = _mm256_sub_epi32(b, _mm256_castps_si256(_mm256_cmp_ps(_mm256_set1_ps(bins->tree[e]), v, _CMP_LE_OQ)));
+  }
+  __m256 under = _mm256_cmp_ps(v, min, _CMP_LT_OQ);
+  __m256 over = _mm256_cmp_ps(v, _mm256_set1_ps(bins->maxes[last]), _CMP_NLT_UQ);
+  b = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b), _mm256_castsi256_ps(_mm256_set1_epi32(BINS_UNDERFLOW(bins))), under));
+  b = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b), _mm256_castsi256_ps(_mm256_set1_epi32(BINS_OVERFLOW(bins))), over));
+  *fix &= ~_mm256_movemask_ps(_mm256_or_ps(under, over));
+  return b;
+}
+
+// AVX2 has no scatter: the bins are stored and counted one by one, but
+// into different sub-histograms (if there are any), so equal bins don't
+// wait on each other
+__attribute__((target("avx2")))
+static void count_avx2(const bins_t *bins, const float *data, long long n, int *sub)
+{
+  int lanes = sub_lanes(bins);
+  long long i;
+  int b[8];
+  for (i = 0; i+8 <= n; i += 8) {
+    int fix;
+    _mm256_storeu_si256((__m256i *)b, find_avx2(bins, _mm256_loadu_ps(data+i), &fix));
+    for (int l = 0; l < 8; l++) {
+      int bin = fix >> l & 1 ? bins_find(bins, data[i+l]) : b[l];
+      sub[bin*lanes + (l & (lanes-1))]++;
+    }
+  }
+  count_scalar(bins, data+i, n-i, sub);
+}
+
+// AVX-512: the bins of 16 values are found as with AVX2 and the counters
+// of their lanes are gathered, incremented and scattered back, lanes 0-7
+// first and then lanes 8-15. Lane l touches counters l mod 8, so there are
+// no conflicts within either half.
+__attribute__((target("avx512f")))
+static void count_avx512(const bins_t *bins, const float *data, long long n, int *sub)
+{
+  int last = bins->count-1;
+  __m512 min = _mm512_set1_ps(bins->min);
+  __m512 top = _mm512_set1_ps(bins->maxes[last]);
+  __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7);
+  __m512i one = _mm512_set1_epi32(1);
+  long long i;
+  for (i = 0; i+16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(data+i);
+    __m512i b;
+    __mmask16 fix = 0;
+    if (bins->method == BINS_ARITHMETIC) {
+      __m512 t = _mm512_mul_ps(_mm512_sub_ps(v, min), _mm512_set1_ps(bins->inv_width));
+      b = _mm512_cvttps_epi32(t);
+      b = _mm512_min_epi32(_mm512_max_epi32(b, _mm512_setzero_si512()), _mm512_set1_epi32(last));
+      __mmask16 first = _mm512_cmpeq_epi32_mask(b, _mm512_setzero_si512());
+      __m512 lo = _mm512_mask_i32gather_ps(min, ~first, _mm512_sub_epi32(b, one), bins->maxes, 4);
+      __m512 hi = _mm512_i32gather_ps(b, bins->maxes, 4);
+      fix = _mm512_cmp_ps_mask(v, lo, _CMP_LT_OQ) | _mm512_cmp_ps_mask(v, hi, _CMP_GE_OQ);
+    }
+    else {
+      b = _mm512_setzero_si512();
+      for (int e = 0; e < bins->count; e++)
+        b = _mm512_mask_add_epi32(b, _mm512_cmp_ps_mask(_mm512_set1_ps(bins->tree[e]), v, _CMP_LE_OQ), b, one);
+    }
+    __mmask16 under = _mm512_cmp_ps_mask(v, min, _CMP_LT_OQ);
+    __mmask16 over = _mm512_cmp_ps_mask(v, top, _CMP_NLT_UQ);
+    b = _mm512_mask_mov_epi32(b, under, _mm512_set1_epi32(BINS_UNDERFLOW(bins)));
+    b = _mm512_mask_mov_epi32(b, over, _mm512_set1_epi32(BINS_OVERFLOW(bins)));
+    fix &= ~(under | over);
+    __m512i at = _mm512_add_epi32(_mm512_slli_epi32(b, 3), lanes);
+    for (__mmask16 half = 0x00ff; half != 0; half = (__mmask16)(half << 8)) {
+      __mmask16 m = half & ~fix;
+      __m512i c = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, at, sub, 4);
+      _mm512_mask_i32scatter_epi32(sub, m, at, _mm512_add_epi32(c, one), 4);
+    }
+    for (int l = 0; fix != 0; l++, fix >>= 1)
+      if (fix & 1)
+        sub[bins_find(bins, data[i+l])*BINS_LANES + (l & (BINS_LANES-1))]++;
+  }
+  count_scalar(bins, data+i, n-i, sub);
+}
+
+void bins_count(const bins_t *bins, const float *data, long long n, int *sub)
+{
+  if (bins->method == BINS_EYTZINGER || count_isa() == 0)
+    count_scalar(bins, data, n, sub);
+  else if (count_isa() == 2 && sub_lanes(bins) == BINS_LANES)
+    count_avx512(bins, data, n, sub);
+  else
+    count_avx2(bins, data, n, sub);
+}
+#else
+void bins_count(const bins_t *bins, const float *data, long long n, int *sub)
+{
+  count_scalar(bins, data, n, sub);
+}
+#endif
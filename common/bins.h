@@ -0,0 +1,101 @@
+/**
+ * bins.h:
+ *
+ * Bin lookup shared by the histograms in HW4 and HW5.
+ *
+ * Bin i holds the values x with maxes[i-1] <= x < maxes[i], where
+ * maxes[-1] = min. Values below min go to the underflow bin and values at or
+ * above maxes[count-1] (and NaNs) to the overflow bin, so a lookup never
+ * fails: a histogram keeps count+2 counters, indexed by bins_find.
+ *
+ * Uniform bins are found in O(1): the bin is estimated as
+ * (x - min)*inv_width and then moved to the one whose edges, as stored in
+ * maxes, really hold x, so the result is the same as a search of maxes.
+ * Other edges (log-spaced, quantiles, read from a file) are counted with
+ * SIMD compares when there are few of them, and otherwise searched in a
+ * copy of maxes in Eytzinger (breadth-first) order, where the next levels of
+ * the search share cache lines and can be prefetched.
+ *
+ **/
+
+#ifndef _BINS_H
+
+#define _BINS_H
+
+#define BINS_ARITHMETIC 0  // uniform bins
+#define BINS_LINEAR 1      // at most BINS_LINEAR_MAX edges, SIMD count
+#define BINS_EYTZINGER 2   // branchless search of the Eytzinger tree
+
+#define BINS_LINEAR_MAX 32
+
+typedef struct {
+  int count;        // number of regular bins
+  float min;        // lower edge of bin 0
+  float *maxes;     // upper edge of every bin, nondecreasing
+  int method;       // how bins_find searches, one of the above
+  float inv_width;  // count/(max - min) for uniform bins
+  float *tree;      // BINS_LINEAR: maxes padded with +inf to a multiple of 8,
+                    // BINS_EYTZINGER: maxes in Eytzinger order from tree[1]
+  int *tree_bin;    // BINS_EYTZINGER: the bin whose upper edge is tree[k]
+} bins_t;
+
+#define BINS_UNDERFLOW(bins) ((bins)->count)
+#define BINS_OVERFLOW(bins) ((bins)->count+1)
+
+// count bins of equal width from min to max, with the edges computed as
+// Gen_bins in the histogram programs always did
+void bins_uniform(bins_t *bins, float min, float max, int count);
+// count bins with the given nondecreasing upper edges (copied), the first
+// starting at min
+void bins_edges(bins_t *bins, float min, const float *maxes, int count);
+// Edges from a text file of whitespace-separated numbers: the lower edge of
+// the first bin, then the upper edge of every bin. Returns 0, or -1 with a
+// message on stderr if the file can't be read or the edges decrease.
+int bins_read(bins_t *bins, const char *path);
+// the <bin_count> argument of the histogram programs: a number of uniform
+// bins from min to max, or else the name of an edge file for bins_read
+int bins_parse(bins_t *bins, const char *arg, float min, float max);
+void bins_free(bins_t *bins);
+
+int bins_search(const bins_t *bins, float x);
+
+// Counting many values at once (bins_count) uses sub-histograms: counter
+// BINS_LANES*b + l counts the values of bin b seen by SIMD lane l (mod
+// BINS_LANES), so the lanes of one vector never update the same counter,
+// even for equal bins. Up to BINS_SUB_MAX bins the copies stay within a
+// 128 KB slice of L2, above it (and on the scalar path) there is one plain
+// histogram, counted in the AVX2 loop when the CPU has it.
+#define BINS_LANES 8
+#define BINS_SUB_MAX 4096
+
+// zeroed sub-histograms for bins_count; every thread needs its own
+int *bins_subcounts(const bins_t *bins);
+// adds the bins of data[0..n-1] to the sub-histograms, 8 or 16 values at
+// a time with AVX2 or AVX-512 (picked at runtime) for uniform bins and up
+// to BINS_LINEAR_MAX edges
+void bins_count(const bins_t *bins, const float *data, long long n, int *sub);
+// adds the sub-histograms to counts[0..count+1] and frees them
+void bins_fold(const bins_t *bins, int *sub, int *counts);
+
+// the bin of x: 0..count-1, BINS_UNDERFLOW or BINS_OVERFLOW
+static inline int bins_find(const bins_t *bins, float x)
+{
+  int last = bins->count-1;
+  if (x < bins->min)
+    return BINS_UNDERFLOW(bins);
+  if (!(x < bins->maxes[last]))
+    return BINS_OVERFLOW(bins);
+  if (bins->method != BINS_ARITHMETIC)
+    return bins_search(bins, x);
+  // the estimate is off by at most one bin for any reasonable count, the
+  // loops make it exact at the edges
+  int i = (int)((x - bins->min)*bins->inv_width);
+  i = i < last ? i : last;
+  while (i > 0 && x < bins->maxes[i-1])
+    i--;
+  while (x >= bins->maxes[i])
+    i++;
+  return i;
+}
+
+#endif
@@ -0,0 +1,324 @@
+/**
+ * rng.c:
+ *
+ * Philox4x32-10 from Salmon et al., "Parallel Random Numbers: As Easy as
+ * 1, 2, 3" (SC 2011). Ten rounds of multiply/xor on a 128-bit counter
+ * under a 64-bit key.
+ *
+ **/
+
+#include <string.h>
+#include <time.h>
+#include "rng.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// number of blocks generated side by side by the batch functions
+#define RNG_LANES 16
+
+static void philox_block(const uint32_t key[2], uint64_t counter, uint64_t stream, uint32_t out[4])
+{
+  uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32);
+  uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+  uint32_t k0 = key[0], k1 = key[1];
+  int r;
+
+  for (r = 0; r < 10; r++) {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+    uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// 32x32->64 multiply of every lane by m, split into high and low words.
+// mul_epu32 only multiplies the even lanes, so the odd lanes are shifted down
+// for a second multiply and the halves are shuffled back in lane order.
+static inline void mulhilo_sse2(__m128i a, __m128i m, __m128i *hi, __m128i *lo)
+{
+  __m128i even = _mm_mul_epu32(a, m);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+  *lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0)),
+                           _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+  *hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(2, 0, 3, 1)),
+                           _mm_shuffle_epi32(odd, _MM_SHUFFLE(2, 0, 3, 1)));
+}
+
+// four blocks per pass, one block per 32-bit lane
+static void philox_lanes_sse2(const uint32_t key[2], uint64_t counter, uint64_t stream, uint32_t *out)
+{
+  const __m128i m0 = _mm_set1_epi32((int)PHILOX_M0), m1 = _mm_set1_epi32((int)PHILOX_M1);
+  int g, r;
+
+  for (g = 0; g < RNG_LANES; g += 4) {
+    uint64_t c = counter + g;
+    __m128i c0 = _mm_setr_epi32((int)c, (int)(c + 1), (int)(c + 2), (int)(c + 3));
+    __m128i c1 = _mm_setr_epi32((int)(c >> 32), (int)((c + 1) >> 32), (int)((c + 2) >> 32), (int)((c + 3) >> 32));
+    __m128i c2 = _mm_set1_epi32((int)stream);
+    __m128i c3 = _mm_set1_epi32((int)(stream >> 32));
+    uint32_t k0 = key[0], k1 = key[1];
+    __m128i hi0, lo0, hi1, lo1, t0, t1, t2, t3;
+
+    for (r = 0; r < 10; r++) {
+      mulhilo_sse2(c0, m0, &hi0, &lo0);
+      mulhilo_sse2(c2, m1, &hi1, &lo1);
+      c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+      c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+      c1 = lo1;
+      c3 = lo0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    // transpose so that every block's four words are contiguous
+    t0 = _mm_unpacklo_epi32(c0, c1);
+    t1 = _mm_unpacklo_epi32(c2, c3);
+    t2 = _mm_unpackhi_epi32(c0, c1);
+    t3 = _mm_unpackhi_epi32(c2, c3);
+    _mm_storeu_si128((__m128i *)(out + 4*g), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(out + 4*g + 4), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(out + 4*g + 8), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(out + 4*g + 12), _mm_unpackhi_epi64(t2, t3));
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void mulhilo_avx2(__m256i a, __m256i m, __m256i *hi, __m256i *lo)
+{
+  __m256i even = _mm256_mul_epu32(a, m);
+  __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+  // even holds (lo, hi) of lanes 0, 2, ..., odd of lanes 1, 3, ...
+  *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+  *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+// eight blocks per pass
+__attribute__((target("avx2")))
+static void philox_lanes_avx2(const uint32_t key[2], uint64_t counter, uint64_t stream, uint32_t *out)
+{
+  const __m256i m0 = _mm256_set1_epi32((int)PHILOX_M0), m1 = _mm256_set1_epi32((int)PHILOX_M1);
+  const __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  int g, r, l;
+
+  for (g = 0; g < RNG_LANES; g += 8) {
+    uint64_t c = counter + g;
+    __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)c), step);
+    __m256i c1, c2, c3, hi0, lo0, hi1, lo1;
+    uint32_t k0 = key[0], k1 = key[1];
+    uint32_t words[4][8];
+
+    if ((uint32_t)c > 0xFFFFFFFFu - 7) {
+      uint32_t carry[8];
+      for (l = 0; l < 8; l++)
+        carry[l] = (uint32_t)((c + l) >> 32);
+      c1 = _mm256_loadu_si256((const __m256i *)carry);
+    }
+    else
+      c1 = _mm256_set1_epi32((int)(c >> 32));
+    c2 = _mm256_set1_epi32((int)stream);
+    c3 = _mm256_set1_epi32((int)(stream >> 32));
+
+    for (r = 0; r < 10; r++) {
+      mulhilo_avx2(c0, m0, &hi0, &lo0);
+      mulhilo_avx2(c2, m1, &hi1, &lo1);
+      c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+      c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+      c1 = lo1;
+      c3 = lo0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    _mm256_storeu_si256((__m256i *)words[0], c0);
+    _mm256_storeu_si256((__m256i *)words[1], c1);
+    _mm256_storeu_si256((__m256i *)words[2], c2);
+    _mm256_storeu_si256((__m256i *)words[3], c3);
+    for (l = 0; l < 8; l++) {
+      out[4*(g+l)] = words[0][l];
+      out[4*(g+l)+1] = words[1][l];
+      out[4*(g+l)+2] = words[2][l];
+      out[4*(g+l)+3] = words[3][l];
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline void mulhilo_avx512(__m512i a, __m512i m, __m512i *hi, __m512i *lo)
+{
+  __m512i even = _mm512_mul_epu32(a, m);
+  __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+  *lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+  *hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+}
+
+// all sixteen blocks in one pass
+__attribute__((target("avx512f")))
+static void philox_lanes_avx512(const uint32_t key[2], uint64_t counter, uint64_t stream, uint32_t *out)
+{
+  const __m512i m0 = _mm512_set1_epi32((int)PHILOX_M0), m1 = _mm512_set1_epi32((int)PHILOX_M1);
+  const __m512i step = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m512i c0 = _mm512_add_epi32(_mm512_set1_epi32((int)counter), step);
+  __m512i c1, c2, c3, hi0, lo0, hi1, lo1;
+  __m512i t0, t1, t2, t3, idx;
+  uint32_t k0 = key[0], k1 = key[1];
+  int l, r;
+
+  if ((uint32_t)counter > 0xFFFFFFFFu - 15) {
+    uint32_t carry[16];
+    for (l = 0; l < 16; l++)
+      carry[l] = (uint32_t)((counter + l) >> 32);
+    c1 = _mm512_loadu_si512(carry);
+  }
+  else
+    c1 = _mm512_set1_epi32((int)(counter >> 32));
+  c2 = _mm512_set1_epi32((int)stream);
+  c3 = _mm512_set1_epi32((int)(stream >> 32));
+
+  for (r = 0; r < 10; r++) {
+    mulhilo_avx512(c0, m0, &hi0, &lo0);
+    mulhilo_avx512(c2, m1, &hi1, &lo1);
+    c0 = _mm512_xor_si512(_mm512_xor_si512(hi1, c1), _mm512_set1_epi32((int)k0));
+    c2 = _mm512_xor_si512(_mm512_xor_si512(hi0, c3), _mm512_set1_epi32((int)k1));
+    c1 = lo1;
+    c3 = lo0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  // interleave the four words of each block: out[4*l+w] = cw[l]
+  t0 = _mm512_unpacklo_epi32(c0, c1);
+  t1 = _mm512_unpackhi_epi32(c0, c1);
+  t2 = _mm512_unpacklo_epi32(c2, c3);
+  t3 = _mm512_unpackhi_epi32(c2, c3);
+  c0 = _mm512_unpacklo_epi64(t0, t2);  // blocks 0, 4, 8, 12
+  c1 = _mm512_unpackhi_epi64(t0, t2);  // blocks 1, 5, 9, 13
+  c2 = _mm512_unpacklo_epi64(t1, t3);  // blocks 2, 6, 10, 14
+  c3 = _mm512_unpackhi_epi64(t1, t3);  // blocks 3, 7, 11, 15
+  idx = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+  t0 = _mm512_permutex2var_epi64(c0, idx, c1);  // blocks 0, 1, 4, 5
+  t1 = _mm512_permutex2var_epi64(c2, idx, c3);  // blocks 2, 3, 6, 7
+  idx = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+  t2 = _mm512_permutex2var_epi64(c0, idx, c1);  // blocks 8, 9, 12, 13
+  t3 = _mm512_permutex2var_epi64(c2, idx, c3);  // blocks 10, 11, 14, 15
+  idx = _mm512_setr_epi64(0, 1, 2, 3, 8, 9, 10, 11);
+  _mm512_storeu_si512(out, _mm512_permutex2var_epi64(t0, idx, t1));
+  _mm512_storeu_si512(out + 32, _mm512_permutex2var_epi64(t2, idx, t3));
+  idx = _mm512_setr_epi64(4, 5, 6, 7, 12, 13, 14, 15);
+  _mm512_storeu_si512(out + 16, _mm512_permutex2var_epi64(t0, idx, t1));
+  _mm512_storeu_si512(out + 48, _mm512_permutex2var_epi64(t2, idx, t3));
+}
+#endif
+
+// RNG_LANES consecutive blocks, in the same order rng_next_u32 would give them
+static void philox_lanes(const uint32_t key[2], uint64_t counter, uint64_t stream, uint32_t out[4*RNG_LANES])
+{
+#if defined(__x86_64__)
+  static int isa = -1;  // 2 = AVX-512, 1 = AVX2, 0 = SSE2
+  if (isa < 0)
+    isa = __builtin_cpu_supports("avx512f") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+  if (isa == 2)
+    philox_lanes_avx512(key, counter, stream, out);
+  else if (isa == 1)
+    philox_lanes_avx2(key, counter, stream, out);
+  else
+    philox_lanes_sse2(key, counter, stream, out);
+#else
+  int l;
+  for (l = 0; l < RNG_LANES; l++)
+    philox_block(key, counter + l, stream, out + 4*l);
+#endif
+}
+
+void rng_init(rng_t *rng, uint64_t seed, uint64_t stream)
+{
+  rng->key[0] = (uint32_t)seed;
+  rng->key[1] = (uint32_t)(seed >> 32);
+  rng->stream = stream;
+  rng->counter = 0;
+  rng->used = 4;
+}
+
+// seed to use when the user did not give one; print it so the run can be repeated
+uint64_t rng_time_seed()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t rng_next_u32(rng_t *rng)
+{
+  if (rng->used == 4) {
+    philox_block(rng->key, rng->counter++, rng->stream, rng->block);
+    rng->used = 0;
+  }
+  return rng->block[rng->used++];
+}
+
+// top 24 bits, so every value is exactly representable and 1.0 never comes out
+float rng_next_float(rng_t *rng)
+{
+  return (float)(rng_next_u32(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+double rng_next_double(rng_t *rng)
+{
+  uint64_t hi = rng_next_u32(rng);
+  uint64_t lo = rng_next_u32(rng);
+  return (double)(((hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void rng_fill_u32(rng_t *rng, uint32_t *out, size_t n)
+{
+  uint32_t tail[4*RNG_LANES];
+  size_t i = 0;
+
+  rng->used = 4;
+  for (; i + 4*RNG_LANES <= n; i += 4*RNG_LANES) {
+    philox_lanes(rng->key, rng->counter, rng->stream, out + i);
+    rng->counter += RNG_LANES;
+  }
+  if (i < n) {
+    philox_lanes(rng->key, rng->counter, rng->stream, tail);
+    rng->counter += RNG_LANES;
+    memcpy(out + i, tail, (n - i)*sizeof(uint32_t));
+  }
+}
+
+void rng_fill_float(rng_t *rng, float *out, size_t n)
+{
+  uint32_t bits[4*RNG_LANES];
+  size_t i, j, len;
+
+  for (i = 0; i < n; i += len) {
+    len = n - i < 4*RNG_LANES ? n - i : 4*RNG_LANES;
+    rng_fill_u32(rng, bits, len);
+    for (j = 0; j < len; j++)
+      out[i+j] = (float)(bits[j] >> 8) * (1.0f / 16777216.0f);
+  }
+}
+
+void rng_fill_double(rng_t *rng, double *out, size_t n)
+{
+  uint32_t bits[4*RNG_LANES];
+  size_t i, j, len;
+
+  for (i = 0; i < n; i += len) {
+    len = n - i < 2*RNG_LANES ? n - i : 2*RNG_LANES;
+    rng_fill_u32(rng, bits, 2*len);
+    for (j = 0; j < len; j++) {
+      uint64_t word = ((uint64_t)bits[2*j] << 32) | bits[2*j+1];
+      out[i+j] = (double)(word >> 11) * (1.0 / 9007199254740992.0);
+    }
+  }
+}
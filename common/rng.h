@@ -0,0 +1,44 @@
+/**
+ * rng.h:
+ *
+ * Counter-based random number generator (Philox4x32-10) shared by the
+ * samplers in HW3, HW4 and HW5.
+ *
+ * Every random block is a pure function of (seed, stream, counter), so one
+ * user seed gives each core or thread its own stream just by passing a
+ * different stream number. Streams never overlap, the result does not depend
+ * on how streams are scheduled, and the same seed reproduces the same run.
+ *
+ **/
+
+#ifndef _RNG_H
+
+#define _RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t key[2];    // the user seed
+  uint64_t stream;    // high 64 bits of the counter, one per core/thread
+  uint64_t counter;   // low 64 bits of the counter, index of the next block
+  uint32_t block[4];  // last generated block
+  int used;           // how many words of block were handed out already
+} rng_t;
+
+void rng_init(rng_t *rng, uint64_t seed, uint64_t stream);
+uint64_t rng_time_seed();
+
+uint32_t rng_next_u32(rng_t *rng);
+float rng_next_float(rng_t *rng);    // uniform in [0, 1)
+double rng_next_double(rng_t *rng);  // uniform in [0, 1)
+
+// Batch versions: fill out[0..n-1] (uniforms in [0, 1) for float/double).
+// They generate 16 blocks at once with SSE2, AVX2 or AVX-512 code picked at
+// runtime, and always start from a fresh block, dropping what is left of the
+// current one.
+void rng_fill_u32(rng_t *rng, uint32_t *out, size_t n);
+void rng_fill_float(rng_t *rng, float *out, size_t n);
+void rng_fill_double(rng_t *rng, double *out, size_t n);
+
+#endif